@@ -0,0 +1,270 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "blit.hh"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WLHELLO_X86 1
+#endif
+
+using FillRowFn = void (*)(std::uint32_t *, std::size_t, std::uint32_t);
+using BlendRowFn = void (*)(std::uint32_t *, const std::uint32_t *,
+                            std::size_t);
+
+struct Kernels {
+  FillRowFn fill_row;
+  BlendRowFn blend_row;
+};
+
+// Source over destination, for premultiplied alpha. Dividing by 255 is done
+// as (x + 128 + ((x + 128) >> 8)) >> 8, which is exact for the products of
+// two 8-bit values, and is what the vector paths do too.
+static std::uint32_t blend_pixel(std::uint32_t dst, std::uint32_t src) {
+  const std::uint32_t inv_alpha = 255 - (src >> 24);
+  std::uint32_t rb = (dst & 0x00ff00ff) * inv_alpha + 0x00800080;
+  rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+  std::uint32_t ag = ((dst >> 8) & 0x00ff00ff) * inv_alpha + 0x00800080;
+  ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+  return src + (rb | ag);
+}
+
+static void fill_row_scalar(std::uint32_t *dst, std::size_t count,
+                            std::uint32_t color) {
+  for (std::size_t i = 0; i < count; ++i) {
+    dst[i] = color;
+  }
+}
+
+static void blend_row_scalar(std::uint32_t *dst, const std::uint32_t *src,
+                             std::size_t count) {
+  for (std::size_t i = 0; i < count; ++i) {
+    dst[i] = blend_pixel(dst[i], src[i]);
+  }
+}
+
+#ifdef WLHELLO_X86
+__attribute__((target("sse2"))) static void
+fill_row_sse2(std::uint32_t *dst, std::size_t count, std::uint32_t color) {
+  const __m128i value = _mm_set1_epi32(static_cast<int>(color));
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), value);
+  }
+  fill_row_scalar(dst + i, count - i, color);
+}
+
+// Blends four pixels, widening each channel to 16 bits.
+__attribute__((target("sse2"))) static __m128i blend_sse2(__m128i dst,
+                                                          __m128i src) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  __m128i inv_alpha =
+      _mm_sub_epi32(_mm_set1_epi32(255), _mm_srli_epi32(src, 24));
+  inv_alpha = _mm_or_si128(inv_alpha, _mm_slli_epi32(inv_alpha, 16));
+
+  __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero),
+                               _mm_unpacklo_epi32(inv_alpha, inv_alpha));
+  __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero),
+                               _mm_unpackhi_epi32(inv_alpha, inv_alpha));
+  lo = _mm_add_epi16(lo, bias);
+  hi = _mm_add_epi16(hi, bias);
+  lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+  hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+  return _mm_add_epi8(src, _mm_packus_epi16(lo, hi));
+}
+
+__attribute__((target("sse2"))) static void
+blend_row_sse2(std::uint32_t *dst, const std::uint32_t *src,
+               std::size_t count) {
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto *d = reinterpret_cast<__m128i *>(dst + i);
+    const auto *s = reinterpret_cast<const __m128i *>(src + i);
+    _mm_storeu_si128(d, blend_sse2(_mm_loadu_si128(d), _mm_loadu_si128(s)));
+  }
+  blend_row_scalar(dst + i, src + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+fill_row_avx2(std::uint32_t *dst, std::size_t count, std::uint32_t color) {
+  const __m256i value = _mm256_set1_epi32(static_cast<int>(color));
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), value);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i + 8), value);
+  }
+  for (; i + 8 <= count; i += 8) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), value);
+  }
+  fill_row_scalar(dst + i, count - i, color);
+}
+
+// As blend_sse2, but eight pixels at a time. Unpacking works within each
+// 128-bit lane, and packing undoes it in the same way.
+__attribute__((target("avx2"))) static void
+blend_row_avx2(std::uint32_t *dst, const std::uint32_t *src,
+               std::size_t count) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i bias = _mm256_set1_epi16(128);
+  const __m256i opaque = _mm256_set1_epi32(255);
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto *d = reinterpret_cast<__m256i *>(dst + i);
+    const __m256i s =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    const __m256i dv = _mm256_loadu_si256(d);
+
+    __m256i inv_alpha = _mm256_sub_epi32(opaque, _mm256_srli_epi32(s, 24));
+    inv_alpha = _mm256_or_si256(inv_alpha, _mm256_slli_epi32(inv_alpha, 16));
+    __m256i lo = _mm256_mullo_epi16(
+        _mm256_unpacklo_epi8(dv, zero),
+        _mm256_unpacklo_epi32(inv_alpha, inv_alpha));
+    __m256i hi = _mm256_mullo_epi16(
+        _mm256_unpackhi_epi8(dv, zero),
+        _mm256_unpackhi_epi32(inv_alpha, inv_alpha));
+    lo = _mm256_add_epi16(lo, bias);
+    hi = _mm256_add_epi16(hi, bias);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+    _mm256_storeu_si256(d, _mm256_add_epi8(s, _mm256_packus_epi16(lo, hi)));
+  }
+  blend_row_sse2(dst + i, src + i, count - i);
+}
+#endif
+
+static Kernels select_kernels() {
+#ifdef WLHELLO_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {fill_row_avx2, blend_row_avx2};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return {fill_row_sse2, blend_row_sse2};
+  }
+#endif
+  return {fill_row_scalar, blend_row_scalar};
+}
+
+static Kernels &kernels() {
+  static Kernels kernels = select_kernels();
+  return kernels;
+}
+
+bool force_blit_path(BlitPath path) {
+  // Selecting the default first also initialises __builtin_cpu_supports.
+  auto &selected = kernels();
+  switch (path) {
+  case BlitPath::scalar:
+    selected = {fill_row_scalar, blend_row_scalar};
+    return true;
+#ifdef WLHELLO_X86
+  case BlitPath::sse2:
+    if (__builtin_cpu_supports("sse2")) {
+      selected = {fill_row_sse2, blend_row_sse2};
+      return true;
+    }
+    break;
+  case BlitPath::avx2:
+    if (__builtin_cpu_supports("avx2")) {
+      selected = {fill_row_avx2, blend_row_avx2};
+      return true;
+    }
+    break;
+#else
+  case BlitPath::sse2:
+  case BlitPath::avx2:
+    break;
+#endif
+  }
+  return false;
+}
+
+// Clips a width x height rectangle at (x, y) to the destination, returning
+// false if nothing is left. src_x and src_y are offset by the amount clipped
+// from the left and top.
+static bool clip(const PixelBuffer &dst, std::int32_t &x, std::int32_t &y,
+                 std::int32_t &width, std::int32_t &height,
+                 std::int32_t &src_x, std::int32_t &src_y) {
+  if (x < 0) {
+    src_x -= x;
+    width += x;
+    x = 0;
+  }
+  if (y < 0) {
+    src_y -= y;
+    height += y;
+    y = 0;
+  }
+  width = std::min(width, dst.width - x);
+  height = std::min(height, dst.height - y);
+  return width > 0 && height > 0;
+}
+
+void fill(const PixelBuffer &dst, std::uint32_t color) {
+  fill_rect(dst, 0, 0, dst.width, dst.height, color);
+}
+
+void fill_rect(const PixelBuffer &dst, std::int32_t x, std::int32_t y,
+               std::int32_t width, std::int32_t height, std::uint32_t color) {
+  std::int32_t src_x = 0;
+  std::int32_t src_y = 0;
+  if (!clip(dst, x, y, width, height, src_x, src_y)) {
+    return;
+  }
+
+  const auto fill_row = kernels().fill_row;
+  // Without padding, the rows are one contiguous run.
+  if (x == 0 && width == dst.stride) {
+    fill_row(dst.pixels + static_cast<std::size_t>(y) * dst.stride,
+             static_cast<std::size_t>(width) * height, color);
+    return;
+  }
+  for (std::int32_t row = y; row < y + height; ++row) {
+    fill_row(dst.pixels + static_cast<std::size_t>(row) * dst.stride + x,
+             static_cast<std::size_t>(width), color);
+  }
+}
+
+void copy(const PixelBuffer &dst, std::int32_t x, std::int32_t y,
+          const PixelBuffer &src) {
+  std::int32_t width = src.width;
+  std::int32_t height = src.height;
+  std::int32_t src_x = 0;
+  std::int32_t src_y = 0;
+  if (!clip(dst, x, y, width, height, src_x, src_y)) {
+    return;
+  }
+
+  // libc's memcpy already picks the widest copy the CPU supports.
+  for (std::int32_t row = 0; row < height; ++row) {
+    std::memcpy(
+        dst.pixels + static_cast<std::size_t>(y + row) * dst.stride + x,
+        src.pixels + static_cast<std::size_t>(src_y + row) * src.stride +
+            src_x,
+        static_cast<std::size_t>(width) * sizeof(std::uint32_t));
+  }
+}
+
+void blend(const PixelBuffer &dst, std::int32_t x, std::int32_t y,
+           const PixelBuffer &src) {
+  std::int32_t width = src.width;
+  std::int32_t height = src.height;
+  std::int32_t src_x = 0;
+  std::int32_t src_y = 0;
+  if (!clip(dst, x, y, width, height, src_x, src_y)) {
+    return;
+  }
+
+  const auto blend_row = kernels().blend_row;
+  for (std::int32_t row = 0; row < height; ++row) {
+    blend_row(
+        dst.pixels + static_cast<std::size_t>(y + row) * dst.stride + x,
+        src.pixels + static_cast<std::size_t>(src_y + row) * src.stride +
+            src_x,
+        static_cast<std::size_t>(width));
+  }
+}
@@ -0,0 +1,29 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include "swapchain.hh"
+
+#include <cstdint>
+
+// Pixel kernels for software rendering into a PixelBuffer. Colours are
+// ARGB8888 or XRGB8888, and blended sources have premultiplied alpha. The
+// fastest implementation the CPU supports is chosen at runtime. Everything
+// is clipped to the destination.
+
+void fill(const PixelBuffer &dst, std::uint32_t color);
+void fill_rect(const PixelBuffer &dst, std::int32_t x, std::int32_t y,
+               std::int32_t width, std::int32_t height, std::uint32_t color);
+
+// Copies src into dst with its top left corner at (x, y).
+void copy(const PixelBuffer &dst, std::int32_t x, std::int32_t y,
+          const PixelBuffer &src);
+// Composites src over dst with its top left corner at (x, y).
+void blend(const PixelBuffer &dst, std::int32_t x, std::int32_t y,
+           const PixelBuffer &src);
+
+// The row kernels, for benchmarking them against each other.
+enum class BlitPath { scalar, sse2, avx2 };
+// Makes every later call use path, returning false if the CPU doesn't
+// support it. Mustn't be called while anything is being drawn.
+bool force_blit_path(BlitPath path);
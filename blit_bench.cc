@@ -0,0 +1,60 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "blit.hh"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+// Times fill() over a 4K buffer with each row kernel the CPU supports, to
+// compare the clear against memory bandwidth.
+int main() {
+  constexpr std::int32_t k_width = 3840;
+  constexpr std::int32_t k_height = 2160;
+  constexpr int k_iterations = 200;
+  constexpr std::size_t k_bytes =
+      std::size_t{k_width} * k_height * sizeof(std::uint32_t);
+
+  const std::unique_ptr<std::uint32_t, decltype(&std::free)> pixels(
+      static_cast<std::uint32_t *>(std::aligned_alloc(64, k_bytes)),
+      &std::free);
+  if (!pixels) {
+    std::fprintf(stderr, "blit_bench: failed to allocate buffer\n");
+    return 1;
+  }
+  const PixelBuffer buffer{.pixels = pixels.get(),
+                           .width = k_width,
+                           .height = k_height,
+                           .stride = k_width};
+
+  static const struct {
+    BlitPath path;
+    const char *name;
+  } paths[]{{BlitPath::scalar, "scalar"},
+            {BlitPath::sse2, "sse2"},
+            {BlitPath::avx2, "avx2"}};
+  for (const auto &[path, name] : paths) {
+    if (!force_blit_path(path)) {
+      std::printf("%-6s  unsupported\n", name);
+      continue;
+    }
+    // Once untimed, so the pages are faulted in.
+    fill(buffer, 0);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < k_iterations; ++i) {
+      fill(buffer, static_cast<std::uint32_t>(i));
+    }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    // Read back a pixel, so the fills can't be optimised away.
+    const volatile std::uint32_t last = pixels.get()[k_bytes / 8];
+    static_cast<void>(last);
+    std::printf("%-6s  %7.3f ms/fill  %6.2f GB/s\n", name,
+                elapsed.count() * 1e3 / k_iterations,
+                static_cast<double>(k_bytes) * k_iterations /
+                    elapsed.count() / 1e9);
+  }
+}
@@ -36,6 +36,8 @@ Result Variables
   True if all required Wayland components are found.
 ``Wayland_VERSION_STRING``
   Version number of Wayland.
+``Wayland_protocols_VERSION``
+  Version number of wayland-protocols, if found.
 ``Wayland_<component>_FOUND``
   True if this component has been found.
 
@@ -94,6 +96,7 @@ pkg_check_modules(PC_Wayland_protocols QUIET wayland-protocols)
 if(PC_Wayland_protocols_FOUND)
   pkg_get_variable(Wayland_protocols_dir wayland-protocols pkgdatadir)
   mark_as_advanced(Wayland_protocols_dir)
+  set(Wayland_protocols_VERSION ${PC_Wayland_protocols_VERSION})
 endif()
 if(Wayland_protocols_dir)
   set(Wayland_protocols_FOUND TRUE)
@@ -0,0 +1,1432 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "display.hh"
+#include "window.hh"
+
+#include <wayland-client.h>
+#include <wayland-cursor-shape-v1-client-protocol.h>
+#include <wayland-cursor.h>
+#include <wayland-egl.h>
+#include <wayland-fractional-scale-v1-client-protocol.h>
+#include <wayland-pointer-constraints-client-protocol.h>
+#include <wayland-presentation-time-client-protocol.h>
+#include <wayland-relative-pointer-client-protocol.h>
+#include <wayland-single-pixel-buffer-v1-client-protocol.h>
+#include <wayland-tablet-client-protocol.h>
+#include <wayland-util.h>
+#include <wayland-viewporter-client-protocol.h>
+#include <wayland-xdg-decoration-client-protocol.h>
+#include <wayland-xdg-shell-client-protocol.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include <EGL/egl.h> // must be included after wayland-egl.h
+#include <EGL/eglext.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <span>
+#include <stdexcept>
+#include <string_view> // IWYU pragma: no_include <string>
+#include <utility>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace {
+
+struct CursorName {
+  std::uint32_t shape;
+  // The XCursor name, for when there's no cursor-shape-v1.
+  const char *name;
+  // Older X names, in order of preference, for themes that predate the CSS
+  // names. libwayland-cursor's built-in cursors only have these.
+  const char *legacy[2];
+};
+
+// Indexed by Cursor.
+constexpr CursorName k_cursor_names[]{
+    {0, nullptr, {}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT, "default", {"left_ptr"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_POINTER, "pointer", {"hand2", "hand1"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_TEXT, "text", {"xterm"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR, "crosshair", {"cross"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_MOVE, "move", {"fleur"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRAB, "grab", {"openhand", "hand1"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRABBING, "grabbing", {"closedhand"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_NOT_ALLOWED,
+     "not-allowed",
+     {"crossed_circle", "circle"}},
+    {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_WAIT, "wait", {"watch"}},
+};
+
+} // namespace
+
+static bool has_extension(std::string_view extensions, std::string_view name) {
+  while (!extensions.empty()) {
+    const auto end = extensions.find(' ');
+    if (extensions.substr(0, end) == name) {
+      return true;
+    }
+    if (end == std::string_view::npos) {
+      break;
+    }
+    extensions.remove_prefix(end + 1);
+  }
+  return false;
+}
+
+Display::Display(bool event_thread) {
+  // Connect to display.
+  m_display = wl_display_connect(nullptr);
+  if (!m_display) {
+    throw std::runtime_error(
+        "wl_display_connect: failed to connect to display");
+  }
+  if (event_thread) {
+    m_queue = wl_display_create_queue(m_display);
+    m_wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (!m_queue || m_wake_fd < 0 || m_stop_fd < 0) {
+      throw std::runtime_error("wl_event_queue: failed to create queue");
+    }
+  }
+
+  // Get registry and bind globals.
+  m_registry = wl_display_get_registry(m_display);
+  static const wl_registry_listener registry_listener{
+      on_registry_global, on_registry_global_remove};
+  wl_registry_add_listener(m_registry, &registry_listener, this);
+  wl_display_dispatch(m_display);
+  wl_display_roundtrip(m_display);
+
+  // Check for required globals.
+  if (!m_compositor) {
+    throw std::runtime_error("wl_compositor: failed to bind global");
+  }
+  if (!m_seat) {
+    throw std::runtime_error("wl_seat: failed to bind version 5 or later");
+  }
+  if (!m_wm_base) {
+    throw std::runtime_error("xdg_wm_base: failed to bind global");
+  }
+  // zxdg_decoration_manager_v1 is optional.
+
+  // Tablets are per seat, and the seat and manager may come in either order.
+  if (m_tablet_manager) {
+    m_tablet_seat =
+        zwp_tablet_manager_v2_get_tablet_seat(m_tablet_manager, m_seat);
+    static const zwp_tablet_seat_v2_listener tablet_seat_listener{
+        on_tablet_added, on_tablet_tool_added, on_tablet_pad_added};
+    zwp_tablet_seat_v2_add_listener(m_tablet_seat, &tablet_seat_listener,
+                                    this);
+  }
+
+  m_keymap_compiler = std::make_unique<KeymapCompiler>();
+  m_repeat_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (m_repeat_fd < 0) {
+    throw std::runtime_error("timerfd_create: failed to create key timer");
+  }
+
+  // Events on m_queue have been waiting since the roundtrip.
+  if (m_queue) {
+    m_event_thread = std::thread(&Display::run_event_thread, this);
+  }
+}
+
+Display::~Display() {
+  // Event thread
+  if (m_event_thread.joinable()) {
+    eventfd_write(m_stop_fd, 1);
+    m_event_thread.join();
+  }
+
+  // EGL
+  if (m_egl_display) {
+    eglDestroyContext(m_egl_display, m_egl_context);
+    eglTerminate(m_egl_display);
+  }
+
+  // xkbcommon
+  m_keymap_compiler.reset();
+  KeymapCache::instance().unref_state(m_xkb_state);
+  m_keymap.reset();
+  close(m_repeat_fd);
+
+  // other wayland objects
+  if (m_keyboard) {
+    wl_keyboard_release(m_keyboard);
+  }
+  for (const auto &tool : m_tablet_tools) {
+    zwp_tablet_tool_v2_destroy(tool->tool);
+  }
+  if (m_tablet_seat) {
+    zwp_tablet_seat_v2_destroy(m_tablet_seat);
+  }
+  if (m_cursor_shape_device) {
+    wp_cursor_shape_device_v1_destroy(m_cursor_shape_device);
+  }
+  if (m_relative_pointer) {
+    zwp_relative_pointer_v1_destroy(m_relative_pointer);
+  }
+  if (m_pointer) {
+    wl_pointer_release(m_pointer);
+  }
+  if (m_touch) {
+    wl_touch_release(m_touch);
+  }
+
+  if (m_cursor_surface) {
+    wl_surface_destroy(m_cursor_surface);
+  }
+  if (m_cursor_theme) {
+    wl_cursor_theme_destroy(m_cursor_theme);
+  }
+
+  // wayland globals
+  if (m_fractional_scale_manager) {
+    wp_fractional_scale_manager_v1_destroy(m_fractional_scale_manager);
+  }
+  if (m_cursor_shape_manager) {
+    wp_cursor_shape_manager_v1_destroy(m_cursor_shape_manager);
+  }
+  if (m_tablet_manager) {
+    zwp_tablet_manager_v2_destroy(m_tablet_manager);
+  }
+  if (m_pointer_constraints) {
+    zwp_pointer_constraints_v1_destroy(m_pointer_constraints);
+  }
+  if (m_relative_pointer_manager) {
+    zwp_relative_pointer_manager_v1_destroy(m_relative_pointer_manager);
+  }
+  if (m_shm) {
+    wl_shm_destroy(m_shm);
+  }
+  if (m_viewporter) {
+    wp_viewporter_destroy(m_viewporter);
+  }
+  if (m_single_pixel_buffer_manager) {
+    wp_single_pixel_buffer_manager_v1_destroy(m_single_pixel_buffer_manager);
+  }
+  if (m_presentation) {
+    wp_presentation_destroy(m_presentation);
+  }
+  if (m_decoration_manager) {
+    zxdg_decoration_manager_v1_destroy(m_decoration_manager);
+  }
+  xdg_wm_base_destroy(m_wm_base);
+  wl_seat_destroy(m_seat);
+  wl_compositor_destroy(m_compositor);
+  wl_registry_destroy(m_registry);
+
+  if (m_queue) {
+    wl_event_queue_destroy(m_queue);
+    close(m_wake_fd);
+    close(m_stop_fd);
+  }
+  wl_display_disconnect(m_display);
+}
+
+void Display::on_registry_global(void *display_ptr, wl_registry *registry,
+                                 std::uint32_t id, const char *interface_ptr,
+                                 std::uint32_t version) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  std::string_view interface = interface_ptr;
+
+  // The newest version of each global that we support. Newer versions can
+  // add events, so only raise one once every listener for it is complete.
+  struct Global {
+    const wl_interface *interface;
+    // Older versions are ignored, as if the global weren't there.
+    std::uint32_t min_version;
+    std::uint32_t version;
+    // Input is dispatched by the event thread. Objects made from the global
+    // inherit its queue.
+    bool input;
+    void (*bound)(Display &, void *, std::uint32_t);
+  };
+  static const Global globals[]{
+      {&wl_compositor_interface, 1, 6, false,
+       [](Display &display, void *proxy, std::uint32_t version) {
+         display.m_compositor = static_cast<wl_compositor *>(proxy);
+         display.m_features.damage_buffer = version >= 4;
+         display.m_features.preferred_buffer_scale = version >= 6;
+       }},
+      {&xdg_wm_base_interface, 1, 6, true,
+       [](Display &display, void *proxy, std::uint32_t version) {
+         display.m_wm_base = static_cast<xdg_wm_base *>(proxy);
+         display.m_features.suspended = version >= 6;
+         static const xdg_wm_base_listener xdg_base_listener{on_wm_base_ping};
+         xdg_wm_base_add_listener(display.m_wm_base, &xdg_base_listener,
+                                  &display);
+       }},
+      // Input relies on wl_pointer.frame, from version 5, and the release
+      // requests, from version 3. Version 8 replaces axis_discrete with
+      // axis_value120.
+      {&wl_seat_interface, 5, 7, true,
+       [](Display &display, void *proxy, std::uint32_t /* version */) {
+         display.m_seat = static_cast<wl_seat *>(proxy);
+         static const wl_seat_listener wl_seat_listener{on_seat_capabilities,
+                                                        on_seat_name};
+         wl_seat_add_listener(display.m_seat, &wl_seat_listener, &display);
+       }},
+      {&wl_shm_interface, 1, 1, false, set_global<&Display::m_shm>},
+      {&zxdg_decoration_manager_v1_interface, 1, 1, false,
+       set_global<&Display::m_decoration_manager>},
+      {&wp_presentation_interface, 1, 1, false,
+       [](Display &display, void *proxy, std::uint32_t /* version */) {
+         display.m_presentation = static_cast<wp_presentation *>(proxy);
+         static const wp_presentation_listener presentation_listener{
+             on_presentation_clock_id};
+         wp_presentation_add_listener(display.m_presentation,
+                                      &presentation_listener, &display);
+       }},
+      {&wp_single_pixel_buffer_manager_v1_interface, 1, 1, false,
+       set_global<&Display::m_single_pixel_buffer_manager>},
+      {&wp_viewporter_interface, 1, 1, false,
+       set_global<&Display::m_viewporter>},
+      {&zwp_relative_pointer_manager_v1_interface, 1, 1, true,
+       set_global<&Display::m_relative_pointer_manager>},
+      {&zwp_pointer_constraints_v1_interface, 1, 1, false,
+       set_global<&Display::m_pointer_constraints>},
+      {&zwp_tablet_manager_v2_interface, 1, 1, true,
+       set_global<&Display::m_tablet_manager>},
+      {&wp_cursor_shape_manager_v1_interface, 1, 1, false,
+       set_global<&Display::m_cursor_shape_manager>},
+      {&wp_fractional_scale_manager_v1_interface, 1, 1, false,
+       set_global<&Display::m_fractional_scale_manager>},
+  };
+
+  for (const auto &global : globals) {
+    if (interface != global.interface->name) {
+      continue;
+    }
+    if (version < global.min_version) {
+      return;
+    }
+    const std::uint32_t bound_version = std::min(version, global.version);
+    void *proxy =
+        wl_registry_bind(registry, id, global.interface, bound_version);
+    // Nothing can have been sent to a new object yet, so it's safe to move.
+    if (proxy && global.input && display.m_queue) {
+      wl_proxy_set_queue(static_cast<wl_proxy *>(proxy), display.m_queue);
+    }
+    global.bound(display, proxy, bound_version);
+    return;
+  }
+}
+
+void Display::on_registry_global_remove(void * /* display_ptr */,
+                                        wl_registry * /* registry */,
+                                        std::uint32_t /* name */) noexcept {}
+
+void Display::on_seat_capabilities(void *display_ptr, wl_seat *seat,
+                                   std::uint32_t capabilities) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  const bool had_keyboard = display.m_keyboard != nullptr;
+  const bool has_keyboard = (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) != 0;
+  if (has_keyboard && !had_keyboard) {
+    display.m_keyboard = wl_seat_get_keyboard(seat);
+    static const wl_keyboard_listener wl_keyboard_listener{
+        on_keyboard_map, on_keyboard_enter, on_keyboard_leave,
+        on_keyboard_key, on_keyboard_mod,   on_keyboard_repeat_info};
+    wl_keyboard_add_listener(display.m_keyboard, &wl_keyboard_listener,
+                             display_ptr);
+  } else if (!has_keyboard && had_keyboard) {
+    display.release_held_keys();
+    wl_keyboard_release(std::exchange(display.m_keyboard, nullptr));
+  }
+
+  const bool had_pointer = display.m_pointer != nullptr;
+  const bool has_pointer = (capabilities & WL_SEAT_CAPABILITY_POINTER) != 0;
+  if (has_pointer && !had_pointer) {
+    display.m_pointer = wl_seat_get_pointer(seat);
+    // axis_value120 and axis_relative_direction are newer than the seat, so
+    // are left null. Older libwayland doesn't have the latter at all.
+    static const wl_pointer_listener wl_pointer_listener{
+        on_pointer_enter,       on_pointer_leave,
+        on_pointer_motion,      on_pointer_button,
+        on_pointer_axis,        on_pointer_frame,
+        on_pointer_axis_source, on_pointer_axis_stop,
+        on_pointer_axis_discrete};
+    wl_pointer_add_listener(display.m_pointer, &wl_pointer_listener,
+                            display_ptr);
+    if (display.m_relative_pointer_manager) {
+      display.m_relative_pointer =
+          zwp_relative_pointer_manager_v1_get_relative_pointer(
+              display.m_relative_pointer_manager, display.m_pointer);
+      static const zwp_relative_pointer_v1_listener relative_pointer_listener{
+          on_relative_motion};
+      zwp_relative_pointer_v1_add_listener(display.m_relative_pointer,
+                                           &relative_pointer_listener,
+                                           display_ptr);
+    }
+    if (display.m_cursor_shape_manager) {
+      display.m_cursor_shape_device = wp_cursor_shape_manager_v1_get_pointer(
+          display.m_cursor_shape_manager, display.m_pointer);
+    }
+  } else if (!has_pointer && had_pointer) {
+    // No leave will be sent, so the focus would otherwise stay.
+    display.publish({.type = Event::Type::pointer_leave});
+    display.publish({.type = Event::Type::pointer_frame});
+    if (display.m_cursor_shape_device) {
+      wp_cursor_shape_device_v1_destroy(
+          std::exchange(display.m_cursor_shape_device, nullptr));
+    }
+    if (display.m_relative_pointer) {
+      zwp_relative_pointer_v1_destroy(
+          std::exchange(display.m_relative_pointer, nullptr));
+    }
+    wl_pointer_release(std::exchange(display.m_pointer, nullptr));
+    ++display.m_pointer_generation;
+  }
+
+  const bool had_touch = display.m_touch != nullptr;
+  const bool has_touch = (capabilities & WL_SEAT_CAPABILITY_TOUCH) != 0;
+  if (has_touch && !had_touch) {
+    display.m_touch = wl_seat_get_touch(seat);
+    static const wl_touch_listener wl_touch_listener{
+        on_touch_down,   on_touch_up,    on_touch_motion,     on_touch_frame,
+        on_touch_cancel, on_touch_shape, on_touch_orientation};
+    wl_touch_add_listener(display.m_touch, &wl_touch_listener, display_ptr);
+  } else if (!has_touch && had_touch) {
+    // No more events will come for the points still down.
+    display.publish({.type = Event::Type::touch_cancel});
+    wl_touch_release(std::exchange(display.m_touch, nullptr));
+  }
+}
+
+void Display::on_keyboard_map(void *display_ptr, wl_keyboard * /* keyboard */,
+                              std::uint32_t format, std::int32_t fd,
+                              std::uint32_t size) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+    close(fd);
+    return;
+  }
+  display.m_keymap_compiler->compile(fd, size);
+}
+
+void Display::on_keyboard_enter(void *display_ptr, wl_keyboard *,
+                                std::uint32_t /* serial */,
+                                wl_surface *surface,
+                                wl_array *keys_array) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.install_keymap();
+  // Null if the surface has since been destroyed.
+  display.m_key_window =
+      surface ? static_cast<Window *>(wl_surface_get_user_data(surface))
+              : nullptr;
+  display.publish(
+      {.type = Event::Type::keyboard_enter, .window = display.m_key_window});
+
+  // These keys were pressed before we had focus, so they're down, but
+  // weren't pressed as far as the application is concerned.
+  const std::span<std::uint32_t> keys(
+      static_cast<std::uint32_t *>(keys_array->data),
+      keys_array->size / sizeof(std::uint32_t));
+  for (auto key : keys) {
+    if (key < k_key_count) {
+      display.m_held_keys.set(key);
+    }
+    display.publish({.type = Event::Type::key_held,
+                     .key = {0, key, display.keysym(key), true, false,
+                             display.m_key_window}});
+  }
+}
+
+void Display::on_keyboard_leave(void *display_ptr,
+                                wl_keyboard * /* keyboard */,
+                                std::uint32_t /* serial */,
+                                wl_surface * /* surface */) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  // Releases won't be sent while we don't have focus.
+  display.release_held_keys();
+}
+
+void Display::on_keyboard_key(void *display_ptr, wl_keyboard *,
+                              std::uint32_t /* serial */, std::uint32_t time,
+                              std::uint32_t key, std::uint32_t state) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.install_keymap();
+  const xkb_keysym_t sym = display.keysym(key);
+  const bool pressed = state == WL_KEYBOARD_KEY_STATE_PRESSED;
+  if (key < k_key_count) {
+    display.m_held_keys.set(key, pressed);
+  }
+  display.m_last_key_time = time;
+  display.publish({.type = Event::Type::key,
+                   .key = {time, key, sym, pressed, false,
+                           display.m_key_window}});
+
+  // The newest key held is the one that repeats.
+  if (pressed && display.m_keymap &&
+      xkb_keymap_key_repeats(display.m_keymap->get(), key + 8)) {
+    display.start_repeat(key, time);
+  } else if (!pressed && display.m_repeating && key == display.m_repeat_key) {
+    display.stop_repeat();
+  }
+}
+
+void Display::on_keyboard_mod(void *display_ptr, wl_keyboard * /* keyboard */,
+                              std::uint32_t /* serial */,
+                              std::uint32_t mods_depressed,
+                              std::uint32_t mods_latched,
+                              std::uint32_t mods_locked,
+                              std::uint32_t group) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.m_mods_depressed = mods_depressed;
+  display.m_mods_latched = mods_latched;
+  display.m_mods_locked = mods_locked;
+  display.m_group = group;
+  display.install_keymap();
+  if (display.m_xkb_state) {
+    xkb_state_update_mask(display.m_xkb_state, mods_depressed, mods_latched,
+                          mods_locked, 0, 0, group);
+    display.update_syms();
+  }
+}
+
+void Display::on_keyboard_repeat_info(void *display_ptr,
+                                      wl_keyboard * /* keyboard */,
+                                      std::int32_t rate,
+                                      std::int32_t delay) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.m_repeat_rate = rate;
+  display.m_repeat_delay = delay;
+  // Takes effect from the next key pressed.
+  if (rate <= 0) {
+    display.stop_repeat();
+  }
+}
+
+void Display::on_pointer_enter(void *display_ptr, wl_pointer * /* pointer */,
+                               std::uint32_t serial,
+                               wl_surface *surface, wl_fixed_t x,
+                               wl_fixed_t y) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  // Null if the surface has since been destroyed.
+  auto *window =
+      surface ? static_cast<Window *>(wl_surface_get_user_data(surface))
+              : nullptr;
+  display.publish({.type = Event::Type::pointer_enter,
+                   .window = window,
+                   .serial = serial,
+                   .motion = {0, static_cast<float>(wl_fixed_to_double(x)),
+                              static_cast<float>(wl_fixed_to_double(y))}});
+}
+
+void Display::on_pointer_leave(void *display_ptr, wl_pointer * /* pointer */,
+                               std::uint32_t /* serial */,
+                               wl_surface * /* surface */) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish({.type = Event::Type::pointer_leave});
+}
+
+void Display::on_pointer_motion(void *display_ptr, wl_pointer * /* pointer */,
+                                std::uint32_t time, wl_fixed_t x,
+                                wl_fixed_t y) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish({.type = Event::Type::pointer_motion,
+                   .motion = {time, static_cast<float>(wl_fixed_to_double(x)),
+                              static_cast<float>(wl_fixed_to_double(y))}});
+}
+
+void Display::on_pointer_button(void *display_ptr, wl_pointer * /* pointer */,
+                                std::uint32_t /* serial */, std::uint32_t time,
+                                std::uint32_t button,
+                                std::uint32_t state) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  const bool pressed = state == WL_POINTER_BUTTON_STATE_PRESSED;
+  display.publish({.type = Event::Type::pointer_button,
+                   .button = {time, button, pressed}});
+}
+
+void Display::on_pointer_axis(void *display_ptr, wl_pointer * /* pointer */,
+                              std::uint32_t time, std::uint32_t axis,
+                              wl_fixed_t value) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  const auto distance = static_cast<float>(wl_fixed_to_double(value));
+  const bool vertical = axis == WL_POINTER_AXIS_VERTICAL_SCROLL;
+  display.publish({.type = Event::Type::pointer_axis,
+                   .motion = {time, vertical ? 0.f : distance,
+                              vertical ? distance : 0.f}});
+}
+
+void Display::on_pointer_frame(void *display_ptr,
+                               wl_pointer * /* pointer */) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish({.type = Event::Type::pointer_frame});
+}
+
+void Display::on_pointer_axis_source(void * /* display_ptr */,
+                                     wl_pointer * /* pointer */,
+                                     std::uint32_t /* source */) noexcept {}
+
+void Display::on_pointer_axis_stop(void * /* display_ptr */,
+                                   wl_pointer * /* pointer */,
+                                   std::uint32_t /* time */,
+                                   std::uint32_t /* axis */) noexcept {}
+
+void Display::on_pointer_axis_discrete(void * /* display_ptr */,
+                                       wl_pointer * /* pointer */,
+                                       std::uint32_t /* axis */,
+                                       std::int32_t /* discrete */) noexcept {}
+
+void Display::on_relative_motion(void *display_ptr,
+                                 zwp_relative_pointer_v1 * /* pointer */,
+                                 std::uint32_t utime_hi,
+                                 std::uint32_t utime_lo, wl_fixed_t /* dx */,
+                                 wl_fixed_t /* dy */, wl_fixed_t dx_unaccel,
+                                 wl_fixed_t dy_unaccel) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish(
+      {.type = Event::Type::relative_motion,
+       .utime = (static_cast<std::uint64_t>(utime_hi) << 32) | utime_lo,
+       .dx = wl_fixed_to_double(dx_unaccel),
+       .dy = wl_fixed_to_double(dy_unaccel)});
+}
+
+void Display::on_tablet_added(void * /* display_ptr */,
+                              zwp_tablet_seat_v2 * /* seat */,
+                              zwp_tablet_v2 *tablet) noexcept {
+  // Samples come from tools, and say nothing about which tablet they're on.
+  zwp_tablet_v2_destroy(tablet);
+}
+
+void Display::on_tablet_tool_added(void *display_ptr,
+                                   zwp_tablet_seat_v2 * /* seat */,
+                                   zwp_tablet_tool_v2 *tool) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  auto &state = *display.m_tablet_tools.emplace_back(
+      std::make_unique<TabletTool>(TabletTool{
+          .display = &display,
+          .tool = tool,
+          .sample = {.tool = display.m_next_tablet_tool++}}));
+  static const zwp_tablet_tool_v2_listener tool_listener{
+      on_tool_type,         on_tool_hardware_serial, on_tool_hardware_id_wacom,
+      on_tool_capability,   on_tool_done,            on_tool_removed,
+      on_tool_proximity_in, on_tool_proximity_out,   on_tool_down,
+      on_tool_up,           on_tool_motion,          on_tool_pressure,
+      on_tool_distance,     on_tool_tilt,            on_tool_rotation,
+      on_tool_slider,       on_tool_wheel,           on_tool_button,
+      on_tool_frame};
+  zwp_tablet_tool_v2_add_listener(tool, &tool_listener, &state);
+}
+
+void Display::on_tablet_pad_added(void * /* display_ptr */,
+                                  zwp_tablet_seat_v2 * /* seat */,
+                                  zwp_tablet_pad_v2 *pad) noexcept {
+  // Pad buttons and rings aren't supported.
+  zwp_tablet_pad_v2_destroy(pad);
+}
+
+void Display::on_tool_type(void *tool_ptr, zwp_tablet_tool_v2 * /* tool */,
+                           std::uint32_t type) noexcept {
+  auto &tool = *static_cast<TabletTool *>(tool_ptr);
+  tool.sample.eraser = type == ZWP_TABLET_TOOL_V2_TYPE_ERASER;
+}
+
+void Display::on_tool_hardware_serial(void * /* tool_ptr */,
+                                      zwp_tablet_tool_v2 * /* tool */,
+                                      std::uint32_t /* serial_hi */,
+                                      std::uint32_t /* serial_lo */) noexcept {
+}
+
+void Display::on_tool_hardware_id_wacom(
+    void * /* tool_ptr */, zwp_tablet_tool_v2 * /* tool */,
+    std::uint32_t /* id_hi */, std::uint32_t /* id_lo */) noexcept {}
+
+void Display::on_tool_capability(void * /* tool_ptr */,
+                                 zwp_tablet_tool_v2 * /* tool */,
+                                 std::uint32_t /* capability */) noexcept {}
+
+void Display::on_tool_done(void * /* tool_ptr */,
+                           zwp_tablet_tool_v2 * /* tool */) noexcept {}
+
+void Display::on_tool_removed(void *tool_ptr,
+                              zwp_tablet_tool_v2 *tool) noexcept {
+  auto &display = *static_cast<TabletTool *>(tool_ptr)->display;
+  zwp_tablet_tool_v2_destroy(tool);
+  std::erase_if(display.m_tablet_tools, [tool_ptr](const auto &state) {
+    return state.get() == tool_ptr;
+  });
+}
+
+void Display::on_tool_proximity_in(void *tool_ptr,
+                                   zwp_tablet_tool_v2 * /* tool */,
+                                   std::uint32_t /* serial */,
+                                   zwp_tablet_v2 * /* tablet */,
+                                   wl_surface *surface) noexcept {
+  auto &tool = *static_cast<TabletTool *>(tool_ptr);
+  // Null if the surface has since been destroyed.
+  if (!surface) {
+    tool.sample.window = nullptr;
+    return;
+  }
+  tool.sample.window = static_cast<Window *>(wl_surface_get_user_data(surface));
+}
+
+void Display::on_tool_proximity_out(void *tool_ptr,
+                                    zwp_tablet_tool_v2 * /* tool */) noexcept {
+  auto &tool = *static_cast<TabletTool *>(tool_ptr);
+  tool.sample.window = nullptr;
+  tool.sample.down = false;
+}
+
+void Display::on_tool_down(void *tool_ptr, zwp_tablet_tool_v2 * /* tool */,
+                           std::uint32_t /* serial */) noexcept {
+  static_cast<TabletTool *>(tool_ptr)->sample.down = true;
+}
+
+void Display::on_tool_up(void *tool_ptr,
+                         zwp_tablet_tool_v2 * /* tool */) noexcept {
+  static_cast<TabletTool *>(tool_ptr)->sample.down = false;
+}
+
+void Display::on_tool_motion(void *tool_ptr, zwp_tablet_tool_v2 * /* tool */,
+                             wl_fixed_t x, wl_fixed_t y) noexcept {
+  auto &tool = *static_cast<TabletTool *>(tool_ptr);
+  tool.sample.x = static_cast<float>(wl_fixed_to_double(x));
+  tool.sample.y = static_cast<float>(wl_fixed_to_double(y));
+}
+
+void Display::on_tool_pressure(void *tool_ptr, zwp_tablet_tool_v2 * /* tool */,
+                               std::uint32_t pressure) noexcept {
+  static_cast<TabletTool *>(tool_ptr)->sample.pressure =
+      static_cast<float>(pressure) / 65535.f;
+}
+
+void Display::on_tool_distance(void * /* tool_ptr */,
+                               zwp_tablet_tool_v2 * /* tool */,
+                               std::uint32_t /* distance */) noexcept {}
+
+void Display::on_tool_tilt(void *tool_ptr, zwp_tablet_tool_v2 * /* tool */,
+                           wl_fixed_t tilt_x, wl_fixed_t tilt_y) noexcept {
+  auto &tool = *static_cast<TabletTool *>(tool_ptr);
+  tool.sample.tilt_x = static_cast<float>(wl_fixed_to_double(tilt_x));
+  tool.sample.tilt_y = static_cast<float>(wl_fixed_to_double(tilt_y));
+}
+
+void Display::on_tool_rotation(void * /* tool_ptr */,
+                               zwp_tablet_tool_v2 * /* tool */,
+                               wl_fixed_t /* degrees */) noexcept {}
+
+void Display::on_tool_slider(void * /* tool_ptr */,
+                             zwp_tablet_tool_v2 * /* tool */,
+                             std::int32_t /* position */) noexcept {}
+
+void Display::on_tool_wheel(void * /* tool_ptr */,
+                            zwp_tablet_tool_v2 * /* tool */,
+                            wl_fixed_t /* degrees */,
+                            std::int32_t /* clicks */) noexcept {}
+
+void Display::on_tool_button(void * /* tool_ptr */,
+                             zwp_tablet_tool_v2 * /* tool */,
+                             std::uint32_t /* serial */,
+                             std::uint32_t /* button */,
+                             std::uint32_t /* state */) noexcept {}
+
+void Display::on_tool_frame(void *tool_ptr, zwp_tablet_tool_v2 * /* tool */,
+                            std::uint32_t time) noexcept {
+  auto &tool = *static_cast<TabletTool *>(tool_ptr);
+  tool.sample.time = time;
+  tool.display->publish({.type = Event::Type::tablet_sample,
+                         .window = tool.sample.window,
+                         .sample = tool.sample});
+}
+
+void Display::on_touch_down(void *display_ptr, wl_touch * /* touch */,
+                            std::uint32_t /* serial */, std::uint32_t time,
+                            wl_surface *surface, std::int32_t id,
+                            wl_fixed_t x, wl_fixed_t y) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  auto *window =
+      surface ? static_cast<Window *>(wl_surface_get_user_data(surface))
+              : nullptr;
+  display.publish({.type = Event::Type::touch_down,
+                   .window = window,
+                   .motion = {time, static_cast<float>(wl_fixed_to_double(x)),
+                              static_cast<float>(wl_fixed_to_double(y))},
+                   .touch_id = id});
+}
+
+void Display::on_touch_up(void *display_ptr, wl_touch * /* touch */,
+                          std::uint32_t /* serial */, std::uint32_t time,
+                          std::int32_t id) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish(
+      {.type = Event::Type::touch_up, .motion = {time}, .touch_id = id});
+}
+
+void Display::on_touch_motion(void *display_ptr, wl_touch * /* touch */,
+                              std::uint32_t time, std::int32_t id,
+                              wl_fixed_t x, wl_fixed_t y) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish({.type = Event::Type::touch_motion,
+                   .motion = {time, static_cast<float>(wl_fixed_to_double(x)),
+                              static_cast<float>(wl_fixed_to_double(y))},
+                   .touch_id = id});
+}
+
+void Display::on_touch_frame(void *display_ptr,
+                             wl_touch * /* touch */) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish({.type = Event::Type::touch_frame});
+}
+
+void Display::on_touch_cancel(void *display_ptr,
+                              wl_touch * /* touch */) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.publish({.type = Event::Type::touch_cancel});
+}
+
+void Display::on_touch_shape(void * /* display_ptr */, wl_touch * /* touch */,
+                             std::int32_t /* id */, wl_fixed_t /* major */,
+                             wl_fixed_t /* minor */) noexcept {}
+
+void Display::on_touch_orientation(void * /* display_ptr */,
+                                   wl_touch * /* touch */,
+                                   std::int32_t /* id */,
+                                   wl_fixed_t /* orientation */) noexcept {}
+
+void Display::on_seat_name(void * /* display_ptr */, wl_seat * /* seat */,
+                           const char * /* name */) noexcept {}
+
+void Display::on_presentation_clock_id(void *display_ptr,
+                                       wp_presentation * /* presentation */,
+                                       std::uint32_t clock_id) noexcept {
+  auto &display = *static_cast<Display *>(display_ptr);
+  display.m_presentation_clock = clock_id;
+}
+
+void Display::on_wm_base_ping(void * /* display_ptr */, xdg_wm_base *wm_base,
+                              std::uint32_t serial) noexcept {
+  xdg_wm_base_pong(wm_base, serial);
+}
+
+std::uint32_t Display::keysym(std::uint32_t key) const {
+  // Add 8 to convert from an evdev scancode to an xkb scancode.
+  const std::uint32_t keycode = key + 8;
+  if (m_syms && keycode < Keymap::k_keycodes) {
+    return m_syms[keycode];
+  }
+  if (!m_xkb_state) {
+    return XKB_KEY_NoSymbol;
+  }
+  return xkb_state_key_get_one_sym(m_xkb_state, keycode);
+}
+
+void Display::update_syms() {
+  if (!m_keymap) {
+    return;
+  }
+  m_syms = m_keymap->syms(
+      xkb_state_serialize_mods(m_xkb_state, XKB_STATE_MODS_EFFECTIVE),
+      xkb_state_serialize_layout(m_xkb_state, XKB_STATE_LAYOUT_EFFECTIVE));
+}
+
+void Display::install_keymap() {
+  auto keymap = m_keymap_compiler->take();
+  if (!keymap) {
+    return;
+  }
+  auto &cache = KeymapCache::instance();
+  xkb_state *state = cache.new_state(*keymap);
+  if (!state) {
+    return;
+  }
+  xkb_state_update_mask(state, m_mods_depressed, m_mods_latched, m_mods_locked,
+                        0, 0, m_group);
+  cache.unref_state(m_xkb_state);
+  m_xkb_state = state;
+  m_keymap = std::move(keymap);
+  update_syms();
+}
+
+void Display::start_repeat(std::uint32_t key, std::uint32_t time) {
+  if (m_repeat_rate <= 0) {
+    return;
+  }
+  // A zero it_value would disarm the timer.
+  const std::int64_t delay =
+      std::max<std::int64_t>(std::int64_t{m_repeat_delay} * 1'000'000, 1);
+  const std::int64_t interval = 1'000'000'000 / m_repeat_rate;
+  itimerspec spec{};
+  spec.it_value.tv_sec = delay / 1'000'000'000;
+  spec.it_value.tv_nsec = delay % 1'000'000'000;
+  spec.it_interval.tv_sec = interval / 1'000'000'000;
+  spec.it_interval.tv_nsec = interval % 1'000'000'000;
+  timerfd_settime(m_repeat_fd, 0, &spec, nullptr);
+
+  m_repeat_key = key;
+  m_repeat_start = time + static_cast<std::uint32_t>(m_repeat_delay);
+  m_repeat_key_rate = m_repeat_rate;
+  m_repeat_count = 0;
+  m_repeating = true;
+}
+
+void Display::release_held_keys() {
+  stop_repeat();
+  // Rather than leave them stuck down.
+  for (std::uint32_t key = 0; key < k_key_count; ++key) {
+    if (m_held_keys.test(key)) {
+      publish({.type = Event::Type::key,
+               .key = {m_last_key_time, key, keysym(key), false, false,
+                       m_key_window}});
+    }
+  }
+  m_held_keys.reset();
+  m_key_window = nullptr;
+  publish({.type = Event::Type::keyboard_leave});
+}
+
+void Display::stop_repeat() {
+  if (m_repeating) {
+    const itimerspec spec{};
+    timerfd_settime(m_repeat_fd, 0, &spec, nullptr);
+    m_repeating = false;
+  }
+}
+
+void Display::repeat_key() {
+  std::uint64_t expirations = 0;
+  if (read(m_repeat_fd, &expirations, sizeof(expirations)) !=
+          sizeof(expirations) ||
+      !m_repeating) {
+    return;
+  }
+  // After a long stall, don't flood the application with repeats. Those
+  // skipped still count, so the timestamps keep up with the timer.
+  m_repeat_count += expirations - std::min<std::uint64_t>(expirations, 8);
+  expirations = std::min<std::uint64_t>(expirations, 8);
+  const std::uint32_t sym = keysym(m_repeat_key);
+  for (; expirations > 0; --expirations) {
+    const auto time =
+        m_repeat_start + static_cast<std::uint32_t>(
+                             m_repeat_count++ * 1000 /
+                             static_cast<std::uint64_t>(m_repeat_key_rate));
+    publish({.type = Event::Type::key,
+             .key = {time, m_repeat_key, sym, true, true, m_key_window}});
+  }
+}
+
+void Display::publish(const Event &event) {
+  if (!m_queue) {
+    handle_event(event);
+    return;
+  }
+  // If the render thread has fallen far behind, hold on to events rather
+  // than lose any.
+  if (m_overflow.empty() && m_events.push(event)) {
+    m_published = true;
+  } else {
+    m_overflow.push_back(event);
+  }
+}
+
+void Display::handle_event(const Event &event) {
+  switch (event.type) {
+  case Event::Type::configure:
+    event.window->configure(event.serial, event.width, event.height,
+                            event.states);
+    break;
+  case Event::Type::close:
+    event.window->m_wants_close = true;
+    break;
+  case Event::Type::key:
+    if (!event.key.repeat && event.key.key < k_key_count) {
+      m_keys.down.set(event.key.key, event.key.pressed);
+      (event.key.pressed ? m_keys.pressed : m_keys.released)
+          .set(event.key.key);
+    }
+    if (std::exchange(m_key_events_taken, false)) {
+      m_key_event_count = 0;
+    }
+    if (m_key_event_count < m_key_events.size()) {
+      m_key_events[m_key_event_count++] = event.key;
+    } else {
+      ++m_key_events_dropped;
+    }
+    break;
+  case Event::Type::key_held:
+    if (event.key.key < k_key_count) {
+      m_keys.down.set(event.key.key);
+    }
+    break;
+  case Event::Type::keyboard_enter:
+    m_keys.focus = event.window;
+    break;
+  case Event::Type::keyboard_leave:
+    m_keys.focus = nullptr;
+    break;
+  case Event::Type::pointer_enter:
+    m_pointer_pending.focus = event.window;
+    m_pointer_pending.x = event.motion.x;
+    m_pointer_pending.y = event.motion.y;
+    // The cursor is undefined until set, so set it straight away.
+    m_pointer_serial = event.serial;
+    if (event.window) {
+      set_cursor(event.window->m_cursor);
+    }
+    break;
+  case Event::Type::pointer_leave:
+    m_pointer_pending.focus = nullptr;
+    break;
+  case Event::Type::pointer_motion:
+    m_pointer_pending.x = event.motion.x;
+    m_pointer_pending.y = event.motion.y;
+    m_pointer_motion.push(event.motion);
+    break;
+  case Event::Type::pointer_button:
+    m_pointer_buttons.push(event.button);
+    break;
+  case Event::Type::pointer_axis:
+    m_pointer_pending.scroll_x += event.motion.x;
+    m_pointer_pending.scroll_y += event.motion.y;
+    break;
+  case Event::Type::pointer_frame:
+    m_pointer_state.focus = m_pointer_pending.focus;
+    m_pointer_state.x = m_pointer_pending.x;
+    m_pointer_state.y = m_pointer_pending.y;
+    m_pointer_state.scroll_x += std::exchange(m_pointer_pending.scroll_x, 0.f);
+    m_pointer_state.scroll_y += std::exchange(m_pointer_pending.scroll_y, 0.f);
+    m_pointer_state.dx += std::exchange(m_pointer_pending.dx, 0.);
+    m_pointer_state.dy += std::exchange(m_pointer_pending.dy, 0.);
+    m_pointer_state.relative_time = m_pointer_pending.relative_time;
+    m_pointer_motion.commit();
+    m_pointer_buttons.commit();
+    break;
+  case Event::Type::tablet_sample:
+    // Published whole on zwp_tablet_tool_v2.frame.
+    m_tablet_samples.push(event.sample);
+    m_tablet_samples.commit();
+    break;
+  case Event::Type::relative_motion:
+    // Part of the pointer's frame, like everything else from the pointer.
+    m_pointer_pending.dx += event.dx;
+    m_pointer_pending.dy += event.dy;
+    m_pointer_pending.relative_time = event.utime;
+    break;
+  case Event::Type::touch_down:
+  case Event::Type::touch_up:
+  case Event::Type::touch_motion:
+    // If a frame overflows, apply what we have rather than lose the rest.
+    if (m_touch_event_count == m_touch_events.size()) {
+      handle_event({.type = Event::Type::touch_frame});
+    }
+    m_touch_events[m_touch_event_count++] = event;
+    break;
+  case Event::Type::touch_frame:
+    for (std::size_t i = 0; i < m_touch_event_count; ++i) {
+      apply_touch_event(m_touch_events[i]);
+    }
+    m_touch_event_count = 0;
+    break;
+  case Event::Type::touch_cancel:
+    // Not part of a frame, and no frame need follow, so it applies now and
+    // the frame in progress goes with it.
+    m_touch_event_count = 0;
+    apply_touch_event(event);
+    break;
+  }
+}
+
+std::span<const KeyEvent> Display::key_events() {
+  m_frame_keys = m_keys;
+  m_keys.pressed.reset();
+  m_keys.released.reset();
+  // Still set if nothing has arrived since the last call.
+  if (m_key_events_taken) {
+    m_key_event_count = 0;
+  }
+  m_key_events_taken = true;
+  return {m_key_events.data(), m_key_event_count};
+}
+
+PointerInput Display::pointer_input() {
+  PointerInput input;
+  input.focus = m_pointer_state.focus;
+  input.x = m_pointer_state.x;
+  input.y = m_pointer_state.y;
+  input.scroll_x = std::exchange(m_pointer_state.scroll_x, 0.f);
+  input.scroll_y = std::exchange(m_pointer_state.scroll_y, 0.f);
+  input.motion = m_pointer_motion.take();
+  input.buttons = m_pointer_buttons.take();
+  input.dx = std::exchange(m_pointer_state.dx, 0.);
+  input.dy = std::exchange(m_pointer_state.dy, 0.);
+  input.relative_time = m_pointer_state.relative_time;
+  return input;
+}
+
+void Display::apply_touch_event(const Event &event) {
+  auto &points = m_touch_points;
+  if (event.type == Event::Type::touch_cancel) {
+    for (std::size_t i = 0; i < points.count; ++i) {
+      points.states[i] |= TouchPoints::k_cancelled;
+    }
+    return;
+  }
+
+  // Ignore points that have lifted but not yet been seen, in case the id
+  // has already been reused.
+  std::size_t index = 0;
+  while (index < points.count &&
+         (points.ids[index] != event.touch_id ||
+          (points.states[index] & TouchPoints::k_up) != 0)) {
+    ++index;
+  }
+  if (index == points.count) {
+    if (event.type != Event::Type::touch_down ||
+        points.count == TouchPoints::k_capacity) {
+      return;
+    }
+    ++points.count;
+    points.ids[index] = event.touch_id;
+    points.states[index] = 0;
+  }
+
+  switch (event.type) {
+  case Event::Type::touch_down:
+    points.x[index] = event.motion.x;
+    points.y[index] = event.motion.y;
+    points.windows[index] = event.window;
+    points.states[index] |= TouchPoints::k_down;
+    break;
+  case Event::Type::touch_motion:
+    points.x[index] = event.motion.x;
+    points.y[index] = event.motion.y;
+    points.states[index] |= TouchPoints::k_moved;
+    break;
+  default:
+    points.states[index] |= TouchPoints::k_up;
+    break;
+  }
+}
+
+void Display::remove_touch_point(std::size_t index) {
+  auto &points = m_touch_points;
+  const std::size_t last = --points.count;
+  points.ids[index] = points.ids[last];
+  points.x[index] = points.x[last];
+  points.y[index] = points.y[last];
+  points.states[index] = points.states[last];
+  points.windows[index] = points.windows[last];
+}
+
+const TouchPoints &Display::touch_points() {
+  m_frame_touch_points = m_touch_points;
+  // Edges start over, and lifted points go.
+  for (std::size_t i = 0; i < m_touch_points.count;) {
+    if ((m_touch_points.states[i] &
+         (TouchPoints::k_up | TouchPoints::k_cancelled)) != 0) {
+      remove_touch_point(i);
+    } else {
+      m_touch_points.states[i] = 0;
+      ++i;
+    }
+  }
+  return m_frame_touch_points;
+}
+
+void Display::forget_window(const Window *window) {
+  // Drop whatever has already been published for the window, and anything
+  // the dispatching thread still points at it.
+  {
+    const std::lock_guard lock(m_dispatch_mutex);
+    std::erase_if(m_overflow, [window](const Event &event) {
+      return event.window == window;
+    });
+    for (const auto &tool : m_tablet_tools) {
+      if (tool->sample.window == window) {
+        tool->sample.window = nullptr;
+      }
+    }
+    // Key events aren't dropped with the window, or the key state would miss
+    // their presses and releases.
+    for (auto &event : m_overflow) {
+      if (event.key.window == window) {
+        event.key.window = nullptr;
+      }
+    }
+    if (m_key_window == window) {
+      m_key_window = nullptr;
+    }
+  }
+  drain_events(window);
+
+  if (m_pointer_pending.focus == window) {
+    m_pointer_pending.focus = nullptr;
+  }
+  if (m_pointer_state.focus == window) {
+    m_pointer_state.focus = nullptr;
+  }
+  for (auto *keys : {&m_keys, &m_frame_keys}) {
+    if (keys->focus == window) {
+      keys->focus = nullptr;
+    }
+  }
+  for (std::size_t i = 0; i < m_key_event_count; ++i) {
+    if (m_key_events[i].window == window) {
+      m_key_events[i].window = nullptr;
+    }
+  }
+  for (auto *points : {&m_touch_points, &m_frame_touch_points}) {
+    std::replace(points->windows.begin(), points->windows.end(),
+                 const_cast<Window *>(window), static_cast<Window *>(nullptr));
+  }
+  for (std::size_t i = 0; i < m_touch_event_count; ++i) {
+    if (m_touch_events[i].window == window) {
+      m_touch_events[i].window = nullptr;
+    }
+  }
+  for (auto &sample : m_tablet_samples.items()) {
+    if (sample.window == window) {
+      sample.window = nullptr;
+    }
+  }
+}
+
+bool Display::drain_events(const Window *discard) {
+  if (!m_queue) {
+    return false;
+  }
+  bool handled = false;
+  Event event;
+  while (m_events.pop(event)) {
+    if (!discard || event.window != discard) {
+      handle_event(event);
+      handled = true;
+    }
+  }
+  return handled;
+}
+
+void Display::flush_overflow() {
+  auto it = m_overflow.begin();
+  while (it != m_overflow.end() && m_events.push(*it)) {
+    ++it;
+  }
+  if (it != m_overflow.begin()) {
+    m_published = true;
+    m_overflow.erase(m_overflow.begin(), it);
+  }
+}
+
+void Display::run_event_thread() noexcept {
+  pollfd fds[3]{{wl_display_get_fd(m_display), POLLIN, 0},
+                {m_stop_fd, POLLIN, 0},
+                {m_repeat_fd, POLLIN, 0}};
+  bool ok = true;
+  while (ok) {
+    bool retry;
+    {
+      const std::lock_guard lock(m_dispatch_mutex);
+      flush_overflow();
+      while (ok && wl_display_prepare_read_queue(m_display, m_queue) != 0) {
+        ok = wl_display_dispatch_queue_pending(m_display, m_queue) >= 0;
+      }
+      retry = !m_overflow.empty();
+    }
+    if (!ok) {
+      break;
+    }
+    if (std::exchange(m_published, false)) {
+      eventfd_write(m_wake_fd, 1);
+    }
+    // Send any pongs. If the socket is full, the render thread will flush.
+    wl_display_flush(m_display);
+
+    // While events are held back, check periodically for room.
+    int ret;
+    do {
+      ret = poll(fds, 3, retry ? 1 : -1);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 || (fds[1].revents & POLLIN) != 0) {
+      wl_display_cancel_read(m_display);
+      ok = ret >= 0;
+      if (ok) {
+        return;
+      }
+    } else if ((fds[0].revents & (POLLIN | POLLERR | POLLHUP)) != 0) {
+      ok = wl_display_read_events(m_display) >= 0;
+    } else {
+      wl_display_cancel_read(m_display);
+    }
+    if ((fds[2].revents & POLLIN) != 0) {
+      const std::lock_guard lock(m_dispatch_mutex);
+      repeat_key();
+    }
+  }
+  m_event_thread_failed.store(true, std::memory_order_relaxed);
+  eventfd_write(m_wake_fd, 1);
+}
+
+void Display::wait_events(int timeout_ms) {
+  // Events published by the event thread count as dispatched.
+  if (drain_events()) {
+    timeout_ms = 0;
+  }
+
+  // Events already in the queue must be dispatched before we may read, and
+  // there's no point blocking if we have dispatched something.
+  while (wl_display_prepare_read(m_display) != 0) {
+    if (wl_display_dispatch_pending(m_display) < 0) {
+      throw std::runtime_error("wl_display: failed to dispatch events");
+    }
+    timeout_ms = 0;
+  }
+
+  // Negative fds are ignored: there's no wake fd without an event thread,
+  // and key repeat is left to the event thread if there is one.
+  pollfd fds[3]{{wl_display_get_fd(m_display), POLLIN, 0},
+                {m_wake_fd, POLLIN, 0},
+                {m_queue ? -1 : m_repeat_fd, POLLIN, 0}};
+  if (wl_display_flush(m_display) < 0) {
+    if (errno != EAGAIN) {
+      wl_display_cancel_read(m_display);
+      throw std::runtime_error("wl_display: failed to flush requests");
+    }
+    // The socket buffer is full, so wait for it to drain as well.
+    fds[0].events |= POLLOUT;
+  }
+
+  int ret;
+  do {
+    ret = poll(fds, 3, timeout_ms);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    wl_display_cancel_read(m_display);
+    throw std::runtime_error("poll: failed to wait for display");
+  }
+
+  if ((fds[0].revents & (POLLIN | POLLERR | POLLHUP)) != 0) {
+    if (wl_display_read_events(m_display) < 0) {
+      throw std::runtime_error("wl_display: failed to read events");
+    }
+  } else {
+    wl_display_cancel_read(m_display);
+  }
+  if ((fds[0].revents & POLLOUT) != 0) {
+    wl_display_flush(m_display);
+  }
+  if (wl_display_dispatch_pending(m_display) < 0) {
+    throw std::runtime_error("wl_display: failed to dispatch events");
+  }
+
+  if ((fds[1].revents & POLLIN) != 0) {
+    eventfd_t count;
+    eventfd_read(m_wake_fd, &count);
+  }
+  if ((fds[2].revents & POLLIN) != 0) {
+    repeat_key();
+  }
+  drain_events();
+  if (m_event_thread_failed.load(std::memory_order_relaxed)) {
+    throw std::runtime_error("wl_display: event thread failed");
+  }
+}
+
+void Display::set_cursor(Cursor cursor) {
+  // The theme is only touched by the render thread, and loading it takes
+  // tens of milliseconds, so that's done before taking the lock, which
+  // would hold up the event thread. Only tried once, even if there's no
+  // theme to load.
+  if (cursor != Cursor::none && !m_cursor_shape_manager &&
+      !m_cursor_surface) {
+    m_cursor_surface = wl_compositor_create_surface(m_compositor);
+    const char *size = std::getenv("XCURSOR_SIZE");
+    const int size_px = size ? std::atoi(size) : 0;
+    if (m_shm) {
+      m_cursor_theme = wl_cursor_theme_load(std::getenv("XCURSOR_THEME"),
+                                            size_px > 0 ? size_px : 24, m_shm);
+    }
+  }
+
+  // The pointer belongs to whichever thread dispatches the seat.
+  const std::lock_guard lock(m_dispatch_mutex);
+  if (!m_pointer) {
+    return;
+  }
+  if (cursor == Cursor::none) {
+    wl_pointer_set_cursor(m_pointer, m_pointer_serial, nullptr, 0, 0);
+    return;
+  }
+  const auto &names = k_cursor_names[static_cast<std::size_t>(cursor)];
+  if (m_cursor_shape_device) {
+    wp_cursor_shape_device_v1_set_shape(m_cursor_shape_device,
+                                        m_pointer_serial, names.shape);
+    return;
+  }
+  if (!m_cursor_theme) {
+    return;
+  }
+  wl_cursor *wl_cursor = wl_cursor_theme_get_cursor(m_cursor_theme, names.name);
+  for (const char *legacy : names.legacy) {
+    if (wl_cursor || !legacy) {
+      break;
+    }
+    wl_cursor = wl_cursor_theme_get_cursor(m_cursor_theme, legacy);
+  }
+  if (!wl_cursor || wl_cursor->image_count == 0) {
+    return;
+  }
+  // Animated cursors are shown as their first frame.
+  wl_cursor_image *image = wl_cursor->images[0];
+  wl_buffer *buffer = wl_cursor_image_get_buffer(image);
+  if (!buffer) {
+    return;
+  }
+  wl_surface_attach(m_cursor_surface, buffer, 0, 0);
+  wl_surface_damage(m_cursor_surface, 0, 0, static_cast<int>(image->width),
+                    static_cast<int>(image->height));
+  wl_surface_commit(m_cursor_surface);
+  wl_pointer_set_cursor(m_pointer, m_pointer_serial, m_cursor_surface,
+                        static_cast<std::int32_t>(image->hotspot_x),
+                        static_cast<std::int32_t>(image->hotspot_y));
+}
+
+void Display::init_egl() {
+  m_egl_display = eglGetDisplay(m_display);
+  if (!m_egl_display) {
+    throw std::runtime_error("egl_display: failed to get display");
+  }
+  EGLint egl_major;
+  EGLint egl_minor;
+  if (!eglInitialize(m_egl_display, &egl_major, &egl_minor)) {
+    throw std::runtime_error("egl: failed to initialise");
+  }
+  const char *egl_extensions = eglQueryString(m_egl_display, EGL_EXTENSIONS);
+  if (egl_extensions) {
+    if (has_extension(egl_extensions, "EGL_KHR_swap_buffers_with_damage")) {
+      m_swap_buffers_with_damage =
+          reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC>(
+              eglGetProcAddress("eglSwapBuffersWithDamageKHR"));
+    } else if (has_extension(egl_extensions,
+                             "EGL_EXT_swap_buffers_with_damage")) {
+      m_swap_buffers_with_damage =
+          reinterpret_cast<PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC>(
+              eglGetProcAddress("eglSwapBuffersWithDamageEXT"));
+    }
+    m_has_buffer_age = has_extension(egl_extensions, "EGL_EXT_buffer_age");
+  }
+  static const EGLint egl_attrs[] = {
+      EGL_RED_SIZE,  8, EGL_GREEN_SIZE,      8,
+      EGL_BLUE_SIZE, 8, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+      EGL_NONE};
+  EGLint num_configs;
+  if (!eglChooseConfig(m_egl_display, egl_attrs, &m_egl_config, 1,
+                       &num_configs)) {
+    throw std::runtime_error("egl_config: failed to choose config");
+  }
+
+  // A context without a surface, which window contexts share objects with.
+  static const EGLint ctx_attrs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  m_egl_context = eglCreateContext(m_egl_display, m_egl_config,
+                                   EGL_NO_CONTEXT, ctx_attrs);
+  if (!m_egl_context) {
+    throw std::runtime_error("egl_context: failed to create context");
+  }
+}
@@ -0,0 +1,628 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include "input_buffer.hh"
+#include "keymap.hh"
+#include "spsc_queue.hh"
+
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class Window;
+
+struct wl_array;
+struct wl_compositor;
+struct wl_cursor_theme;
+struct wl_display;
+struct wl_event_queue;
+struct wl_keyboard;
+struct wl_pointer;
+struct wl_registry;
+struct wl_seat;
+struct wl_shm;
+struct wl_surface;
+struct wl_touch;
+struct wp_cursor_shape_device_v1;
+struct wp_cursor_shape_manager_v1;
+struct wp_fractional_scale_manager_v1;
+struct wp_presentation;
+struct wp_single_pixel_buffer_manager_v1;
+struct wp_viewporter;
+struct xdg_wm_base;
+struct xkb_state;
+struct zwp_pointer_constraints_v1;
+struct zwp_relative_pointer_manager_v1;
+struct zwp_relative_pointer_v1;
+struct zwp_tablet_manager_v2;
+struct zwp_tablet_pad_v2;
+struct zwp_tablet_seat_v2;
+struct zwp_tablet_tool_v2;
+struct zwp_tablet_v2;
+struct zxdg_decoration_manager_v1;
+
+// A key press or release, in the order they happened.
+struct KeyEvent {
+  // Milliseconds, with an undefined base.
+  std::uint32_t time{0};
+  // evdev scancode.
+  std::uint32_t key{0};
+  // xkb_keysym_t, with the modifiers at the time applied.
+  std::uint32_t sym{0};
+  bool pressed{false};
+  // A press generated by key repeat, rather than by the compositor.
+  bool repeat{false};
+  // The window with keyboard focus, or null if it's gone.
+  Window *window{nullptr};
+};
+
+// A pointer position, in surface coordinates.
+struct PointerMotion {
+  // Milliseconds, with an undefined base.
+  std::uint32_t time{0};
+  float x{0.f};
+  float y{0.f};
+};
+
+struct PointerButton {
+  std::uint32_t time{0};
+  // Linux input event code, such as BTN_LEFT.
+  std::uint32_t button{0};
+  bool pressed{false};
+};
+
+// Pointer input since the last Display::pointer_input().
+struct PointerInput {
+  // The window under the pointer, or null.
+  Window *focus{nullptr};
+  // The latest position, which is all most applications need.
+  float x{0.f};
+  float y{0.f};
+  // Scroll distance, in the same units as motion.
+  float scroll_x{0.f};
+  float scroll_y{0.f};
+  // Every position reported, oldest first, for applications like drawing
+  // that need the whole path.
+  std::span<const PointerMotion> motion;
+  std::span<const PointerButton> buttons;
+  // Unaccelerated relative motion, which keeps coming while the pointer is
+  // locked. Only reported if the compositor supports
+  // zwp_relative_pointer_manager_v1.
+  double dx{0.};
+  double dy{0.};
+  // Microseconds, with an undefined base, of the latest relative motion.
+  std::uint64_t relative_time{0};
+};
+
+// Touch points, as parallel arrays so that gesture code can process every
+// contact in one vectorisable loop. Points are in no particular order.
+struct TouchPoints {
+  static constexpr std::size_t k_capacity = 16;
+
+  // What happened to a point since the last Display::touch_points(). A
+  // point can be down and up at once, if it was a quick tap.
+  static constexpr std::uint8_t k_down = 1 << 0;
+  static constexpr std::uint8_t k_moved = 1 << 1;
+  static constexpr std::uint8_t k_up = 1 << 2;
+  static constexpr std::uint8_t k_cancelled = 1 << 3;
+
+  std::size_t count{0};
+  std::array<std::int32_t, k_capacity> ids{};
+  // Surface coordinates.
+  std::array<float, k_capacity> x{};
+  std::array<float, k_capacity> y{};
+  std::array<std::uint8_t, k_capacity> states{};
+  // The window each point went down on, or null if it's gone.
+  std::array<Window *, k_capacity> windows{};
+};
+
+// A tablet tool's state, such as a stylus's, as of one
+// zwp_tablet_tool_v2.frame. Tablets report hundreds of these a second.
+struct TabletSample {
+  // Milliseconds, with an undefined base.
+  std::uint32_t time{0};
+  // Tells apart tools in use at once. Never reused.
+  std::uint32_t tool{0};
+  // The window the tool is over, or null once it has left proximity or the
+  // window is gone.
+  Window *window{nullptr};
+  // Surface coordinates.
+  float x{0.f};
+  float y{0.f};
+  // From 0 to 1, or 0 if the tool doesn't sense pressure.
+  float pressure{0.f};
+  // Degrees from perpendicular, positive towards the right and the bottom.
+  float tilt_x{0.f};
+  float tilt_y{0.f};
+  // Whether the tool is touching the tablet.
+  bool down{false};
+  bool eraser{false};
+};
+
+// Optional protocol features, which depend on the versions of the globals
+// the compositor has.
+struct DisplayFeatures {
+  // wl_surface.damage_buffer, from wl_compositor 4.
+  bool damage_buffer{false};
+  // wl_surface.preferred_buffer_scale, from wl_compositor 6.
+  bool preferred_buffer_scale{false};
+  // The suspended xdg_toplevel state, from xdg_wm_base 6. Without it, a
+  // hidden window is only noticeable by frame callbacks stopping.
+  bool suspended{false};
+};
+
+// Pointer cursors, named after the CSS cursors they match.
+enum class Cursor : std::uint8_t {
+  // Hidden, such as while the pointer is locked.
+  none,
+  arrow,
+  pointer,
+  text,
+  crosshair,
+  move,
+  grab,
+  grabbing,
+  not_allowed,
+  wait,
+};
+
+using EGLBoolean = unsigned int;
+using EGLConfig = void *;
+using EGLContext = void *;
+using EGLDisplay = void *;
+using EGLint = std::int32_t;
+using EGLSurface = void *;
+
+// A connection to the compositor, shared by any number of windows. Owns the
+// globals, input devices and the EGL display, so that opening another window
+// only costs a surface. Must outlive its windows.
+class Display {
+  friend class Window;
+
+public:
+  // Keys with evdev scancodes below this have their state tracked.
+  static constexpr std::size_t k_key_count = 256;
+
+private:
+  // Keys held, and keys that went down or up, by evdev scancode.
+  struct KeyState {
+    std::bitset<k_key_count> down;
+    std::bitset<k_key_count> pressed;
+    std::bitset<k_key_count> released;
+    // The window with keyboard focus, or null.
+    Window *focus{nullptr};
+  };
+
+  // Input and configure state, handed from the thread that dispatched it to
+  // the render thread.
+  struct Event {
+    // key_held is a key already down when focus arrived, which isn't
+    // reported as a key event.
+    enum class Type : std::uint8_t {
+      configure,
+      close,
+      key,
+      key_held,
+      keyboard_enter,
+      keyboard_leave,
+      pointer_enter,
+      pointer_leave,
+      pointer_motion,
+      pointer_button,
+      // Uses motion.x and motion.y for the scroll distance.
+      pointer_axis,
+      pointer_frame,
+      relative_motion,
+      tablet_sample,
+      touch_down,
+      touch_up,
+      touch_motion,
+      touch_frame,
+      touch_cancel,
+    };
+    Type type{Type::configure};
+    Window *window{nullptr};
+    // configure
+    std::uint32_t serial{0};
+    std::int32_t width{0};
+    std::int32_t height{0};
+    // Bit n set for xdg_toplevel state n.
+    std::uint32_t states{0};
+    KeyEvent key{};
+    PointerMotion motion{};
+    PointerButton button{};
+    std::int32_t touch_id{0};
+    // relative_motion
+    std::uint64_t utime{0};
+    double dx{0.};
+    double dy{0.};
+    TabletSample sample{};
+  };
+
+  // Pointer state as of the latest event, and as of the latest
+  // wl_pointer.frame.
+  struct PointerState {
+    Window *focus{nullptr};
+    float x{0.f};
+    float y{0.f};
+    float scroll_x{0.f};
+    float scroll_y{0.f};
+    double dx{0.};
+    double dy{0.};
+    std::uint64_t relative_time{0};
+  };
+
+  wl_display *m_display{nullptr};
+  DisplayFeatures m_features;
+
+  // wayland globals
+  wl_registry *m_registry{nullptr};
+  wl_compositor *m_compositor{nullptr};
+  wl_seat *m_seat{nullptr};
+  wl_shm *m_shm{nullptr};
+  xdg_wm_base *m_wm_base{nullptr};
+  zxdg_decoration_manager_v1 *m_decoration_manager{nullptr};
+  wp_presentation *m_presentation{nullptr};
+  wp_single_pixel_buffer_manager_v1 *m_single_pixel_buffer_manager{nullptr};
+  wp_viewporter *m_viewporter{nullptr};
+  zwp_relative_pointer_manager_v1 *m_relative_pointer_manager{nullptr};
+  zwp_pointer_constraints_v1 *m_pointer_constraints{nullptr};
+  zwp_tablet_manager_v2 *m_tablet_manager{nullptr};
+  wp_cursor_shape_manager_v1 *m_cursor_shape_manager{nullptr};
+  wp_fractional_scale_manager_v1 *m_fractional_scale_manager{nullptr};
+
+  // other wayland objects
+  wl_keyboard *m_keyboard{nullptr};
+  wl_pointer *m_pointer{nullptr};
+  // Bumped whenever the pointer goes away, so that windows can tell that
+  // their pointer locks went with it.
+  std::uint32_t m_pointer_generation{0};
+  zwp_relative_pointer_v1 *m_relative_pointer{nullptr};
+  wp_cursor_shape_device_v1 *m_cursor_shape_device{nullptr};
+  wl_touch *m_touch{nullptr};
+  zwp_tablet_seat_v2 *m_tablet_seat{nullptr};
+
+  // xkbcommon
+  xkb_state *m_xkb_state{nullptr};
+  std::shared_ptr<const Keymap> m_keymap;
+  // The keymap's keysyms for the current modifiers, if it has them.
+  const std::uint32_t *m_syms{nullptr};
+  // Keymaps are swapped in when ready, and until then keys are looked up in
+  // the previous one. The modifiers are kept to carry over to the new state.
+  std::unique_ptr<KeymapCompiler> m_keymap_compiler;
+  std::uint32_t m_mods_depressed{0};
+  std::uint32_t m_mods_latched{0};
+  std::uint32_t m_mods_locked{0};
+  std::uint32_t m_group{0};
+
+  // Key repeat is up to the client. A timerfd, armed while a repeating key
+  // is held, is polled by whichever thread dispatches the keyboard.
+  int m_repeat_fd{-1};
+  // Keys per second, and milliseconds before the first repeat.
+  std::int32_t m_repeat_rate{25};
+  std::int32_t m_repeat_delay{600};
+  std::uint32_t m_repeat_key{0};
+  // Repeat n is timestamped m_repeat_start + n * 1000 / m_repeat_key_rate,
+  // worked out afresh each time so that rounding doesn't add up.
+  std::uint32_t m_repeat_start{0};
+  std::int32_t m_repeat_key_rate{0};
+  std::uint64_t m_repeat_count{0};
+  bool m_repeating{false};
+
+  // Keys down as the compositor last told us, kept by the thread that
+  // dispatches the keyboard to release them when focus leaves.
+  std::bitset<k_key_count> m_held_keys;
+  std::uint32_t m_last_key_time{0};
+  // The window with keyboard focus, as the compositor last told us, for
+  // tagging key events. Guarded by m_dispatch_mutex.
+  Window *m_key_window{nullptr};
+
+  // EGL. Every window's context shares objects with m_egl_context.
+  EGLDisplay m_egl_display{nullptr};
+  EGLConfig m_egl_config{nullptr};
+  EGLContext m_egl_context{nullptr};
+  // EGL_KHR_swap_buffers_with_damage or EGL_EXT_swap_buffers_with_damage.
+  EGLBoolean (*m_swap_buffers_with_damage)(EGLDisplay, EGLSurface,
+                                           const EGLint *, EGLint){nullptr};
+  bool m_has_buffer_age{false};
+
+  std::uint32_t m_presentation_clock{1}; // CLOCK_MONOTONIC
+
+  // Event thread. The seat, its devices and xdg objects live on m_queue,
+  // which is only dispatched by m_event_thread, so a slow frame doesn't hold
+  // up input or pings. Null unless an event thread was requested.
+  wl_event_queue *m_queue{nullptr};
+  std::thread m_event_thread;
+  // Held while m_queue is dispatched, so that listeners can be set up and
+  // objects destroyed without racing the event thread.
+  std::mutex m_dispatch_mutex;
+  SpscQueue<Event, 256> m_events;
+  // Events that didn't fit in m_events, in order. Guarded by
+  // m_dispatch_mutex.
+  std::vector<Event> m_overflow;
+  bool m_published{false};
+  // eventfds: m_wake_fd wakes the render thread when events are published,
+  // m_stop_fd stops the event thread.
+  int m_wake_fd{-1};
+  int m_stop_fd{-1};
+  std::atomic<bool> m_event_thread_failed{false};
+
+  // Key events since key_events() was last called. Cleared by the first
+  // event after that, so the returned span stays valid until then.
+  std::array<KeyEvent, 256> m_key_events{};
+  std::size_t m_key_event_count{0};
+  bool m_key_events_taken{false};
+  std::uint64_t m_key_events_dropped{0};
+  // Key state, as of the latest event and as of the last key_events().
+  KeyState m_keys;
+  KeyState m_frame_keys;
+
+  // Pointer input is held back until wl_pointer.frame, so a frame's events
+  // are seen together.
+  PointerState m_pointer_pending;
+  PointerState m_pointer_state;
+  InputBuffer<PointerMotion, 1024> m_pointer_motion;
+  InputBuffer<PointerButton, 64> m_pointer_buttons;
+  // From the latest wl_pointer.enter, for setting the cursor.
+  std::uint32_t m_pointer_serial{0};
+
+  // Without cursor-shape-v1, cursors come from the XCursor theme. Loading it
+  // costs tens of milliseconds and megabytes of shm, so that's left until a
+  // cursor is first needed, and every window shares it.
+  wl_cursor_theme *m_cursor_theme{nullptr};
+  wl_surface *m_cursor_surface{nullptr};
+
+  // A tablet tool's axes are gathered on the dispatching thread until
+  // zwp_tablet_tool_v2.frame, as each sample takes several events and only
+  // whole samples are worth a place in m_events.
+  struct TabletTool {
+    Display *display{nullptr};
+    zwp_tablet_tool_v2 *tool{nullptr};
+    TabletSample sample;
+  };
+  std::vector<std::unique_ptr<TabletTool>> m_tablet_tools;
+  std::uint32_t m_next_tablet_tool{0};
+  InputBuffer<TabletSample, 512> m_tablet_samples;
+
+  // Touch events are applied to m_touch_points together on wl_touch.frame.
+  std::array<Event, 64> m_touch_events{};
+  std::size_t m_touch_event_count{0};
+  TouchPoints m_touch_points;
+  TouchPoints m_frame_touch_points;
+
+  // Stores a newly bound global that needs no listener.
+  template <auto member>
+  static void set_global(Display &display, void *proxy,
+                         std::uint32_t /* version */) {
+    display.*member =
+        static_cast<std::remove_reference_t<decltype(display.*member)>>(
+            proxy);
+  }
+
+  // wl_registry callbacks
+  static void on_registry_global(void *, wl_registry *, std::uint32_t,
+                                 const char *, std::uint32_t) noexcept;
+  static void on_registry_global_remove(void *, wl_registry *,
+                                        std::uint32_t) noexcept;
+
+  // wl_seat callbacks
+  static void on_seat_capabilities(void *, wl_seat *, std::uint32_t) noexcept;
+  static void on_seat_name(void *, wl_seat *, const char *) noexcept;
+
+  // wl_keyboard callbacks
+  static void on_keyboard_map(void *, wl_keyboard *, std::uint32_t,
+                              std::int32_t, std::uint32_t) noexcept;
+  static void on_keyboard_enter(void *, wl_keyboard *, std::uint32_t,
+                                wl_surface *, wl_array *) noexcept;
+  static void on_keyboard_leave(void *, wl_keyboard *, std::uint32_t,
+                                wl_surface *) noexcept;
+  static void on_keyboard_key(void *, wl_keyboard *, std::uint32_t,
+                              std::uint32_t, std::uint32_t,
+                              std::uint32_t) noexcept;
+  static void on_keyboard_mod(void *, wl_keyboard *, std::uint32_t,
+                              std::uint32_t, std::uint32_t, std::uint32_t,
+                              std::uint32_t) noexcept;
+  static void on_keyboard_repeat_info(void *, wl_keyboard *, std::int32_t,
+                                      std::int32_t) noexcept;
+
+  // wl_pointer callbacks
+  static void on_pointer_enter(void *, wl_pointer *, std::uint32_t,
+                               wl_surface *, std::int32_t,
+                               std::int32_t) noexcept;
+  static void on_pointer_leave(void *, wl_pointer *, std::uint32_t,
+                               wl_surface *) noexcept;
+  static void on_pointer_motion(void *, wl_pointer *, std::uint32_t,
+                                std::int32_t, std::int32_t) noexcept;
+  static void on_pointer_button(void *, wl_pointer *, std::uint32_t,
+                                std::uint32_t, std::uint32_t,
+                                std::uint32_t) noexcept;
+  static void on_pointer_axis(void *, wl_pointer *, std::uint32_t,
+                              std::uint32_t, std::int32_t) noexcept;
+  static void on_pointer_frame(void *, wl_pointer *) noexcept;
+  static void on_pointer_axis_source(void *, wl_pointer *,
+                                     std::uint32_t) noexcept;
+  static void on_pointer_axis_stop(void *, wl_pointer *, std::uint32_t,
+                                   std::uint32_t) noexcept;
+  static void on_pointer_axis_discrete(void *, wl_pointer *, std::uint32_t,
+                                       std::int32_t) noexcept;
+
+  // zwp_relative_pointer_v1 callbacks
+  static void on_relative_motion(void *, zwp_relative_pointer_v1 *,
+                                 std::uint32_t, std::uint32_t, std::int32_t,
+                                 std::int32_t, std::int32_t,
+                                 std::int32_t) noexcept;
+
+  // zwp_tablet_seat_v2 callbacks
+  static void on_tablet_added(void *, zwp_tablet_seat_v2 *,
+                              zwp_tablet_v2 *) noexcept;
+  static void on_tablet_tool_added(void *, zwp_tablet_seat_v2 *,
+                                   zwp_tablet_tool_v2 *) noexcept;
+  static void on_tablet_pad_added(void *, zwp_tablet_seat_v2 *,
+                                  zwp_tablet_pad_v2 *) noexcept;
+
+  // zwp_tablet_tool_v2 callbacks
+  static void on_tool_type(void *, zwp_tablet_tool_v2 *,
+                           std::uint32_t) noexcept;
+  static void on_tool_hardware_serial(void *, zwp_tablet_tool_v2 *,
+                                      std::uint32_t, std::uint32_t) noexcept;
+  static void on_tool_hardware_id_wacom(void *, zwp_tablet_tool_v2 *,
+                                        std::uint32_t, std::uint32_t) noexcept;
+  static void on_tool_capability(void *, zwp_tablet_tool_v2 *,
+                                 std::uint32_t) noexcept;
+  static void on_tool_done(void *, zwp_tablet_tool_v2 *) noexcept;
+  static void on_tool_removed(void *, zwp_tablet_tool_v2 *) noexcept;
+  static void on_tool_proximity_in(void *, zwp_tablet_tool_v2 *,
+                                   std::uint32_t, zwp_tablet_v2 *,
+                                   wl_surface *) noexcept;
+  static void on_tool_proximity_out(void *, zwp_tablet_tool_v2 *) noexcept;
+  static void on_tool_down(void *, zwp_tablet_tool_v2 *,
+                           std::uint32_t) noexcept;
+  static void on_tool_up(void *, zwp_tablet_tool_v2 *) noexcept;
+  static void on_tool_motion(void *, zwp_tablet_tool_v2 *, std::int32_t,
+                             std::int32_t) noexcept;
+  static void on_tool_pressure(void *, zwp_tablet_tool_v2 *,
+                               std::uint32_t) noexcept;
+  static void on_tool_distance(void *, zwp_tablet_tool_v2 *,
+                               std::uint32_t) noexcept;
+  static void on_tool_tilt(void *, zwp_tablet_tool_v2 *, std::int32_t,
+                           std::int32_t) noexcept;
+  static void on_tool_rotation(void *, zwp_tablet_tool_v2 *,
+                               std::int32_t) noexcept;
+  static void on_tool_slider(void *, zwp_tablet_tool_v2 *,
+                             std::int32_t) noexcept;
+  static void on_tool_wheel(void *, zwp_tablet_tool_v2 *, std::int32_t,
+                            std::int32_t) noexcept;
+  static void on_tool_button(void *, zwp_tablet_tool_v2 *, std::uint32_t,
+                             std::uint32_t, std::uint32_t) noexcept;
+  static void on_tool_frame(void *, zwp_tablet_tool_v2 *,
+                            std::uint32_t) noexcept;
+
+  // wl_touch callbacks
+  static void on_touch_down(void *, wl_touch *, std::uint32_t, std::uint32_t,
+                            wl_surface *, std::int32_t, std::int32_t,
+                            std::int32_t) noexcept;
+  static void on_touch_up(void *, wl_touch *, std::uint32_t, std::uint32_t,
+                          std::int32_t) noexcept;
+  static void on_touch_motion(void *, wl_touch *, std::uint32_t, std::int32_t,
+                              std::int32_t, std::int32_t) noexcept;
+  static void on_touch_frame(void *, wl_touch *) noexcept;
+  static void on_touch_cancel(void *, wl_touch *) noexcept;
+  static void on_touch_shape(void *, wl_touch *, std::int32_t, std::int32_t,
+                             std::int32_t) noexcept;
+  static void on_touch_orientation(void *, wl_touch *, std::int32_t,
+                                   std::int32_t) noexcept;
+
+  // wp_presentation callbacks
+  static void on_presentation_clock_id(void *, wp_presentation *,
+                                       std::uint32_t) noexcept;
+
+  // xdg_wm_base_interface callbacks
+  static void on_wm_base_ping(void *, xdg_wm_base *, std::uint32_t) noexcept;
+
+  // Looks up the keysym for an evdev scancode with the current modifiers.
+  std::uint32_t keysym(std::uint32_t key) const;
+  void update_syms();
+  void install_keymap();
+  void start_repeat(std::uint32_t key, std::uint32_t time);
+  void stop_repeat();
+  // For when the keyboard leaves or goes away, so won't send releases. Focus
+  // goes too.
+  void release_held_keys();
+  // Publishes a repeat for each time the timer has expired.
+  void repeat_key();
+
+  // EGL is set up when the first window needs it.
+  void init_egl();
+  void set_cursor(Cursor cursor);
+
+  // Handles an event now if there's no event thread, or otherwise queues it
+  // for the render thread.
+  void publish(const Event &event);
+  void handle_event(const Event &event);
+  // Handles published events on the render thread, except those for discard.
+  // Returns true if any were handled.
+  bool drain_events(const Window *discard = nullptr);
+  // Forgets a window that's being destroyed, once nothing more can be
+  // published for it.
+  void forget_window(const Window *window);
+  void apply_touch_event(const Event &event);
+  void remove_touch_point(std::size_t index);
+  void flush_overflow();
+  void run_event_thread() noexcept;
+
+public:
+  // With event_thread, input and window management events are dispatched on
+  // a background thread and picked up by wait_events().
+  explicit Display(bool event_thread = false);
+  Display(const Display &) = delete;
+  Display(Display &&) = delete;
+  ~Display();
+
+  // Dispatches pending events, blocking until woken by the compositor, key
+  // repeat or the event thread, or until timeout_ms milliseconds have passed.
+  // A negative timeout waits indefinitely. Waking doesn't mean anything was
+  // dispatched on this thread, so callers waiting on some state should check
+  // it and call again.
+  void wait_events(int timeout_ms = -1);
+
+  // Key events received since the last call, oldest first. Meant to be
+  // called once per frame. The span is valid until events are next
+  // dispatched, which Window::acquire_pixels() does too, so don't hold on to
+  // it across that call. When focus leaves, a release is generated for every
+  // key still held.
+  std::span<const KeyEvent> key_events();
+  // Key events lost because more arrived between calls to key_events() than
+  // could be buffered.
+  std::uint64_t key_events_dropped() const { return m_key_events_dropped; }
+
+  // Keyboard state by evdev scancode, as of the last key_events(). A key
+  // counts as pressed or released if it went down or up in that batch, so a
+  // key tapped within one batch is both.
+  bool key_down(std::uint32_t key) const {
+    return key < k_key_count && m_frame_keys.down.test(key);
+  }
+  bool key_pressed(std::uint32_t key) const {
+    return key < k_key_count && m_frame_keys.pressed.test(key);
+  }
+  bool key_released(std::uint32_t key) const {
+    return key < k_key_count && m_frame_keys.released.test(key);
+  }
+  // The window with keyboard focus as of the last key_events(), or null.
+  Window *keyboard_focus() const { return m_frame_keys.focus; }
+
+  const DisplayFeatures &features() const { return m_features; }
+
+  // Pointer input received since the last call, up to the latest
+  // wl_pointer.frame. Meant to be called once per frame. As with
+  // key_events(), the spans are valid until events are next dispatched.
+  PointerInput pointer_input();
+  bool has_relative_motion() const {
+    return m_relative_pointer_manager != nullptr;
+  }
+
+  // Tablet tool samples received since the last call, oldest first, up to
+  // each tool's latest frame. Meant to be called once per frame. As with
+  // key_events(), the span is valid until events are next dispatched.
+  std::span<const TabletSample> tablet_samples() {
+    return m_tablet_samples.take();
+  }
+  // Samples lost because more arrived between calls than fit.
+  std::uint64_t tablet_samples_dropped() const {
+    return m_tablet_samples.dropped();
+  }
+
+  // Touch points, up to the latest wl_touch.frame or wl_touch.cancel. Points
+  // that lifted or were cancelled are included once, and gone from the next
+  // call. Losing the touch capability cancels every point. Meant to be
+  // called once per frame.
+  const TouchPoints &touch_points();
+};
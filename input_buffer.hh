@@ -0,0 +1,61 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// Fixed-capacity storage for input that arrives in protocol frames and is
+// read by the application once per rendered frame. Items pushed since the
+// last commit() are held back, so the application never sees half a frame.
+// take() returns everything committed since the previous take(), which stays
+// valid until the next push() or commit().
+template <typename T, std::size_t N> class InputBuffer {
+  std::array<T, N> m_items{};
+  std::size_t m_committed{0};
+  std::size_t m_end{0};
+  bool m_taken{false};
+  std::uint64_t m_dropped{0};
+
+  // Forgets items already returned by take(), keeping any pending ones.
+  void discard_taken() {
+    if (m_taken) {
+      std::copy(m_items.begin() + m_committed, m_items.begin() + m_end,
+                m_items.begin());
+      m_end -= m_committed;
+      m_committed = 0;
+      m_taken = false;
+    }
+  }
+
+public:
+  void push(const T &item) {
+    discard_taken();
+    if (m_end < N) {
+      m_items[m_end++] = item;
+    } else {
+      ++m_dropped;
+    }
+  }
+
+  void commit() {
+    discard_taken();
+    m_committed = m_end;
+  }
+
+  std::span<const T> take() {
+    discard_taken();
+    m_taken = true;
+    return {m_items.data(), m_committed};
+  }
+
+  // Every item held, whether taken, committed or pending, for fixing up
+  // references to things that have gone away.
+  std::span<T> items() { return {m_items.data(), m_end}; }
+
+  // Items lost because more arrived between take()s than fit.
+  std::uint64_t dropped() const { return m_dropped; }
+};
@@ -0,0 +1,215 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "keymap.hh"
+
+#include <xkbcommon/xkbcommon.h>
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+Keymap::Keymap(xkb_keymap *keymap) : m_keymap(keymap) {
+  // NumLock and LevelThree are Mod2 and Mod5 in every layout that
+  // xkeyboard-config ships.
+  static const char *const names[k_mod_count] = {
+      XKB_MOD_NAME_SHIFT, XKB_MOD_NAME_CAPS, XKB_MOD_NAME_NUM, "Mod5"};
+  for (std::size_t i = 0; i < k_mod_count; ++i) {
+    const xkb_mod_index_t index = xkb_keymap_mod_get_index(keymap, names[i]);
+    if (index != XKB_MOD_INVALID && index < 32) {
+      m_mods[i] = 1u << index;
+      m_all_mods |= m_mods[i];
+    }
+  }
+
+  xkb_state *state = xkb_state_new(keymap);
+  if (!state) {
+    return;
+  }
+  m_layouts = std::min<std::size_t>(xkb_keymap_num_layouts(keymap),
+                                    k_max_layouts);
+  m_syms.assign(m_layouts * k_combinations * k_keycodes, XKB_KEY_NoSymbol);
+  const xkb_keycode_t min_keycode = xkb_keymap_min_keycode(keymap);
+  const xkb_keycode_t max_keycode =
+      std::min<xkb_keycode_t>(xkb_keymap_max_keycode(keymap), k_keycodes - 1);
+
+  // Ask xkbcommon what each key produces in each state, so that levels,
+  // key types and Lock's capitalisation all come out exactly as it would
+  // have them.
+  auto *syms = m_syms.data();
+  for (std::size_t layout = 0; layout < m_layouts; ++layout) {
+    for (std::size_t combination = 0; combination < k_combinations;
+         ++combination) {
+      xkb_mod_mask_t mods = 0;
+      for (std::size_t i = 0; i < k_mod_count; ++i) {
+        if ((combination & (1 << i)) != 0) {
+          mods |= m_mods[i];
+        }
+      }
+      xkb_state_update_mask(state, mods, 0, 0, 0, 0,
+                            static_cast<xkb_layout_index_t>(layout));
+      for (xkb_keycode_t keycode = min_keycode; keycode <= max_keycode;
+           ++keycode) {
+        syms[keycode] = xkb_state_key_get_one_sym(state, keycode);
+      }
+      syms += k_keycodes;
+    }
+  }
+  xkb_state_unref(state);
+}
+
+Keymap::~Keymap() { xkb_keymap_unref(m_keymap); }
+
+const std::uint32_t *Keymap::syms(std::uint32_t mods,
+                                  std::uint32_t layout) const {
+  if (layout >= m_layouts || (mods & ~m_all_mods) != 0) {
+    return nullptr;
+  }
+  std::size_t combination = 0;
+  for (std::size_t i = 0; i < k_mod_count; ++i) {
+    if ((mods & m_mods[i]) != 0) {
+      combination |= std::size_t{1} << i;
+    }
+  }
+  return &m_syms[(layout * k_combinations + combination) * k_keycodes];
+}
+
+KeymapCache &KeymapCache::instance() {
+  static KeymapCache cache;
+  return cache;
+}
+
+std::shared_ptr<const Keymap> KeymapCache::find(std::uint64_t hash,
+                                                std::string_view text) {
+  const auto it = std::find_if(
+      m_entries.begin(), m_entries.end(), [&](const Entry &entry) {
+        return entry.hash == hash && entry.text == text;
+      });
+  if (it == m_entries.end()) {
+    return nullptr;
+  }
+  // Now the most recently used.
+  std::rotate(it, it + 1, m_entries.end());
+  return m_entries.back().keymap;
+}
+
+std::shared_ptr<const Keymap> KeymapCache::load(std::string_view text) {
+  const std::uint64_t hash = std::hash<std::string_view>{}(text);
+  {
+    const std::lock_guard lock(m_mutex);
+    if (auto keymap = find(hash, text)) {
+      return keymap;
+    }
+  }
+
+  // Compiling can take milliseconds, so it's done without the lock, in a
+  // context that only this keymap refers to.
+  xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  if (!context) {
+    return nullptr;
+  }
+  xkb_keymap *xkb_keymap =
+      xkb_keymap_new_from_buffer(context, text.data(), text.size(),
+                                 XKB_KEYMAP_FORMAT_TEXT_V1,
+                                 XKB_KEYMAP_COMPILE_NO_FLAGS);
+  xkb_context_unref(context);
+  if (!xkb_keymap) {
+    return nullptr;
+  }
+  auto compiled = std::make_unique<Keymap>(xkb_keymap);
+
+  // Both freed after unlocking, as freeing a shared keymap takes the lock.
+  std::shared_ptr<const Keymap> evicted;
+  const std::lock_guard lock(m_mutex);
+  // Another thread may have compiled the same keymap in the meantime.
+  if (auto keymap = find(hash, text)) {
+    return keymap;
+  }
+  std::shared_ptr<const Keymap> keymap(
+      compiled.release(), [this](const Keymap *ptr) {
+        const std::lock_guard lock(m_mutex);
+        delete ptr;
+      });
+  if (m_entries.size() == k_capacity) {
+    evicted = std::move(m_entries.front().keymap);
+    m_entries.erase(m_entries.begin());
+  }
+  m_entries.push_back({hash, std::string(text), keymap});
+  return keymap;
+}
+
+xkb_state *KeymapCache::new_state(const Keymap &keymap) {
+  const std::lock_guard lock(m_mutex);
+  return xkb_state_new(keymap.get());
+}
+
+void KeymapCache::unref_state(xkb_state *state) {
+  if (state) {
+    const std::lock_guard lock(m_mutex);
+    xkb_state_unref(state);
+  }
+}
+
+KeymapCompiler::~KeymapCompiler() {
+  if (m_thread.joinable()) {
+    {
+      const std::lock_guard lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  delete m_result.load(std::memory_order_acquire);
+}
+
+void KeymapCompiler::compile(int fd, std::uint32_t size) {
+  {
+    const std::lock_guard lock(m_mutex);
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+    m_fd = fd;
+    m_size = size;
+  }
+  // Started on first use, as most displays only ever get one keymap.
+  if (!m_thread.joinable()) {
+    m_thread = std::thread(&KeymapCompiler::run, this);
+  }
+  m_wake.notify_one();
+}
+
+void KeymapCompiler::run() {
+  std::unique_lock lock(m_mutex);
+  for (;;) {
+    m_wake.wait(lock, [this] { return m_stopping || m_fd >= 0; });
+    if (m_stopping) {
+      return;
+    }
+    const int fd = std::exchange(m_fd, -1);
+    const std::uint32_t size = m_size;
+    lock.unlock();
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    std::shared_ptr<const Keymap> keymap;
+    if (data != MAP_FAILED) {
+      // The text is usually, but not always, NUL terminated.
+      const char *text = static_cast<const char *>(data);
+      keymap = KeymapCache::instance().load({text, strnlen(text, size)});
+      munmap(data, size);
+    }
+    if (keymap) {
+      delete m_result.exchange(
+          new std::shared_ptr<const Keymap>(std::move(keymap)),
+          std::memory_order_acq_rel);
+    }
+
+    lock.lock();
+  }
+}
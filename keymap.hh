@@ -0,0 +1,136 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+struct xkb_keymap;
+struct xkb_state;
+
+// A compiled xkb keymap, along with the keysym of every key under each
+// combination of the modifiers that ordinary typing uses: Shift, Lock,
+// NumLock and LevelThree (AltGr). While only those are active, looking up a
+// keysym is a single load rather than a walk through xkbcommon's structures.
+class Keymap {
+public:
+  // xkb keycodes covered by the tables. Evdev scancodes are 8 less.
+  static constexpr std::size_t k_keycodes = 256;
+
+private:
+  static constexpr std::size_t k_max_layouts = 4;
+  static constexpr std::size_t k_mod_count = 4;
+  static constexpr std::size_t k_combinations = 1 << k_mod_count;
+
+  xkb_keymap *m_keymap;
+  // The modifier mask of each of the tabulated modifiers, or 0 if the
+  // keymap doesn't have it.
+  std::array<std::uint32_t, k_mod_count> m_mods{};
+  std::uint32_t m_all_mods{0};
+  std::size_t m_layouts{0};
+  // Indexed by layout, then modifier combination, then keycode.
+  std::vector<std::uint32_t> m_syms;
+
+public:
+  // Takes ownership of keymap. Keymaps are normally made by KeymapCache.
+  explicit Keymap(xkb_keymap *keymap);
+  Keymap(const Keymap &) = delete;
+  Keymap(Keymap &&) = delete;
+  ~Keymap();
+
+  xkb_keymap *get() const { return m_keymap; }
+
+  // The keysym of every keycode below k_keycodes, given the effective
+  // modifiers and layout, or nullptr if those aren't tabulated.
+  const std::uint32_t *syms(std::uint32_t mods, std::uint32_t layout) const;
+};
+
+// Compiled keymaps, shared by every Display in the process. Compositors send
+// the same keymap to every client, seat and window, so keymaps are looked up
+// by a hash of their text and only compiled the first time. The most recently
+// used keymaps are kept even when unused, to survive reconnects and seats
+// coming and going.
+//
+// xkbcommon's reference counts aren't atomic, so anything that refs or unrefs
+// a shared keymap, including making a state for it, goes through here.
+// Compiling happens outside the lock, in a context of its own, as nothing
+// else can see the keymap until it's added.
+class KeymapCache {
+  static constexpr std::size_t k_capacity = 4;
+
+  struct Entry {
+    std::uint64_t hash{0};
+    // Compared in full, so that a hash collision can't return the wrong
+    // keymap.
+    std::string text;
+    std::shared_ptr<const Keymap> keymap;
+  };
+
+  std::mutex m_mutex;
+  // Least recently used first.
+  std::vector<Entry> m_entries;
+
+  KeymapCache() = default;
+
+  // Must be called with m_mutex held. Marks the keymap found as the most
+  // recently used.
+  std::shared_ptr<const Keymap> find(std::uint64_t hash,
+                                     std::string_view text);
+
+public:
+  KeymapCache(const KeymapCache &) = delete;
+  KeymapCache(KeymapCache &&) = delete;
+  ~KeymapCache() = default;
+
+  static KeymapCache &instance();
+
+  // Returns the compiled form of an XKB_V1 text keymap, or null if it
+  // doesn't compile.
+  std::shared_ptr<const Keymap> load(std::string_view text);
+
+  xkb_state *new_state(const Keymap &keymap);
+  void unref_state(xkb_state *state);
+};
+
+// Compiles keymaps on a background thread, as a large keymap can take
+// milliseconds and would otherwise hold up event dispatch. Only the newest
+// keymap matters, so one that arrives while another is waiting replaces it.
+class KeymapCompiler {
+  std::thread m_thread;
+
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  int m_fd{-1};
+  std::uint32_t m_size{0};
+  bool m_stopping{false};
+
+  // Handed over without locking, so that take() is cheap enough to call on
+  // every key event.
+  std::atomic<std::shared_ptr<const Keymap> *> m_result{nullptr};
+
+  void run();
+
+public:
+  KeymapCompiler() = default;
+  KeymapCompiler(const KeymapCompiler &) = delete;
+  KeymapCompiler(KeymapCompiler &&) = delete;
+  ~KeymapCompiler();
+
+  // Starts compiling the XKB_V1 text keymap in fd, taking ownership of it.
+  void compile(int fd, std::uint32_t size);
+  // The newest compiled keymap, or null if there's nothing new.
+  std::shared_ptr<const Keymap> take() {
+    const std::unique_ptr<std::shared_ptr<const Keymap>> result(
+        m_result.exchange(nullptr, std::memory_order_acquire));
+    return result ? std::move(*result) : nullptr;
+  }
+};
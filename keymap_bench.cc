@@ -0,0 +1,109 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "keymap.hh"
+
+#include <xkbcommon/xkbcommon.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+struct KeyPress {
+  std::uint32_t keycode;
+  std::uint32_t mods;
+};
+
+// Times a lookup function over the stream, returning nanoseconds per lookup
+// and a checksum of the keysyms, so both paths can be checked against each
+// other and neither is optimised away.
+template <typename F>
+double time_lookups(const std::vector<KeyPress> &presses, F &&lookup,
+                    std::uint64_t &checksum) {
+  const auto start = std::chrono::steady_clock::now();
+  checksum = 0;
+  for (const auto &press : presses) {
+    checksum += lookup(press);
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / static_cast<double>(presses.size());
+}
+
+} // namespace
+
+// Replays a stream of key presses, with Shift going up and down, through
+// Keymap's tables and through xkb_state_key_get_one_sym, the way Display
+// looks up keysyms for key events.
+int main() {
+  constexpr std::size_t k_presses = 10'000'000;
+
+  xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  // The default RMLVO names, usually us.
+  xkb_keymap *xkb_keymap = context ? xkb_keymap_new_from_names(
+                                         context, nullptr,
+                                         XKB_KEYMAP_COMPILE_NO_FLAGS)
+                                   : nullptr;
+  if (!xkb_keymap) {
+    std::fprintf(stderr, "keymap_bench: failed to compile keymap\n");
+    return 1;
+  }
+  const Keymap keymap(xkb_keymap);
+  xkb_state *state = xkb_state_new(xkb_keymap);
+  const xkb_mod_index_t shift =
+      xkb_keymap_mod_get_index(xkb_keymap, XKB_MOD_NAME_SHIFT);
+
+  // Letters and digits, with Shift toggled every few presses.
+  std::vector<KeyPress> presses(k_presses);
+  std::uint32_t random = 0x9e3779b9;
+  std::uint32_t mods = 0;
+  for (auto &press : presses) {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    if (random % 8 == 0) {
+      mods ^= 1u << shift;
+    }
+    // Evdev KEY_1 to KEY_M, as xkb keycodes.
+    press = {10 + random % 49, mods};
+  }
+
+  std::uint32_t table_mods = ~0u;
+  const std::uint32_t *syms = nullptr;
+  std::uint64_t table_checksum;
+  const double table_ns = time_lookups(
+      presses,
+      [&](const KeyPress &press) {
+        if (press.mods != table_mods) {
+          table_mods = press.mods;
+          syms = keymap.syms(table_mods, 0);
+        }
+        return syms[press.keycode];
+      },
+      table_checksum);
+
+  std::uint32_t state_mods = ~0u;
+  std::uint64_t state_checksum;
+  const double state_ns = time_lookups(
+      presses,
+      [&](const KeyPress &press) {
+        if (press.mods != state_mods) {
+          state_mods = press.mods;
+          xkb_state_update_mask(state, state_mods, 0, 0, 0, 0, 0);
+        }
+        return xkb_state_key_get_one_sym(state, press.keycode);
+      },
+      state_checksum);
+
+  std::printf("table      %6.2f ns/lookup\n", table_ns);
+  std::printf("xkb_state  %6.2f ns/lookup\n", state_ns);
+  xkb_state_unref(state);
+  xkb_context_unref(context);
+  if (table_checksum != state_checksum) {
+    std::fprintf(stderr, "keymap_bench: keysyms differ\n");
+    return 1;
+  }
+}
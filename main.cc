@@ -1,16 +1,78 @@
 // SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
 // SPDX-License-Identifier: GPL-3.0-or-later
+#include "blit.hh"
+#include "display.hh"
+#include "tile_renderer.hh"
 #include "window.hh"
 
 #include <GLES3/gl31.h>
+#include <xkbcommon/xkbcommon-keysyms.h>
 
-int main() {
-  Window window;
-  window.make_current();
+#include <cstdint>
+#include <memory>
+#include <string_view>
 
-  while (!window.wants_close()) {
-    window.update();
-    glClearColor(1.f, 0.f, 1.f, 1.f);
-    glClear(GL_COLOR_BUFFER_BIT);
+int main(int argc, char *argv[]) {
+  bool software = false;
+  bool event_thread = false;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--software") {
+      // Render on the CPU into shared memory instead of with GLES.
+      software = true;
+    } else if (arg == "--event-thread") {
+      // Dispatch input and window management off the render thread.
+      event_thread = true;
+    }
+  }
+
+  Display display(event_thread);
+  Window window(display);
+  // The renderer's threads are only worth starting for software rendering.
+  std::unique_ptr<TileRenderer> renderer;
+  if (software) {
+    renderer = std::make_unique<TileRenderer>();
+  } else {
+    window.make_current();
+  }
+  window.set_frame_callbacks(true);
+  // The picture only changes with the size, so like the tiles, it's only
+  // drawn again after a resize. Until then, the loop just waits for events.
+  std::int32_t drawn_width = 0;
+  std::int32_t drawn_height = 0;
+
+  bool quit = false;
+  while (!quit && !window.wants_close()) {
+    display.wait_events();
+    // Once visible again, the window wants a frame straight away, and there
+    // may be no more events to wake us for it.
+    if (!window.is_visible()) {
+      window.wait_until_visible();
+    }
+    if (!window.ready_to_draw()) {
+      continue;
+    }
+    for (const auto &event : display.key_events()) {
+      quit |= event.pressed && event.sym == XKB_KEY_Escape;
+    }
+    if (software) {
+      // Tiles are only redrawn after a resize, so most frames present
+      // nothing at all.
+      const auto damage =
+          renderer->render(window.acquire_pixels(),
+                           [](const PixelBuffer &tile, const Rect &) {
+                             fill(tile, 0xffff00ff);
+                           });
+      if (!damage.empty()) {
+        window.present_pixels(damage);
+      }
+    } else if (window.buffer_width() != drawn_width ||
+               window.buffer_height() != drawn_height) {
+      drawn_width = window.buffer_width();
+      drawn_height = window.buffer_height();
+      glClearColor(1.f, 0.f, 1.f, 1.f);
+      glClear(GL_COLOR_BUFFER_BIT);
+      window.update();
+    }
   }
 }
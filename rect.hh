@@ -0,0 +1,14 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <cstdint>
+
+// A rectangle with the origin at the top left. As damage, it's in buffer
+// coordinates, which differ from surface coordinates on scaled outputs.
+struct Rect {
+  std::int32_t x{0};
+  std::int32_t y{0};
+  std::int32_t width{0};
+  std::int32_t height{0};
+};
@@ -0,0 +1,42 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// A fixed-capacity queue for passing items from one producer thread to one
+// consumer thread without locking. Capacity must be a power of two.
+template <typename T, std::size_t N> class SpscQueue {
+  static_assert(N > 0 && (N & (N - 1)) == 0, "capacity must be a power of 2");
+
+  // The indices only ever increase, and are kept on separate cache lines so
+  // the two threads don't contend for them.
+  alignas(64) std::atomic<std::size_t> m_head{0};
+  alignas(64) std::atomic<std::size_t> m_tail{0};
+  alignas(64) std::array<T, N> m_items{};
+
+public:
+  // Producer only. Returns false if the queue is full.
+  bool push(const T &item) {
+    const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == N) {
+      return false;
+    }
+    m_items[tail & (N - 1)] = item;
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only. Returns false if the queue is empty.
+  bool pop(T &item) {
+    const std::size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = m_items[head & (N - 1)];
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+};
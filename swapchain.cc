@@ -0,0 +1,154 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "swapchain.hh"
+
+#include <wayland-client.h>
+
+#include <stdexcept>
+#include <utility>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+ShmSwapchain::ShmSwapchain(wl_shm *shm, std::int32_t width,
+                           std::int32_t height)
+    : m_shm(shm), m_width(width), m_height(height) {
+  create_buffers();
+}
+
+ShmSwapchain::~ShmSwapchain() {
+  // We're going away, so don't wait for the compositor to release anything.
+  for (auto &slot : m_slots) {
+    slot.busy = false;
+  }
+  destroy_buffers();
+}
+
+void ShmSwapchain::on_buffer_release(void *swapchain_ptr,
+                                     wl_buffer *buffer) noexcept {
+  // Buffers orphaned by a resize have no swapchain.
+  if (!swapchain_ptr) {
+    wl_buffer_destroy(buffer);
+    return;
+  }
+
+  auto &swapchain = *static_cast<ShmSwapchain *>(swapchain_ptr);
+  for (auto &slot : swapchain.m_slots) {
+    if (slot.buffer == buffer) {
+      slot.busy = false;
+    }
+  }
+}
+
+void ShmSwapchain::create_buffers() {
+  const auto stride = static_cast<std::size_t>(m_width) * 4;
+  const auto buffer_size = stride * static_cast<std::size_t>(m_height);
+  m_size = buffer_size * k_buffer_count;
+
+  m_fd = memfd_create("wlhello-shm", MFD_CLOEXEC);
+  if (m_fd < 0) {
+    throw std::runtime_error("memfd_create: failed to create pool");
+  }
+  if (ftruncate(m_fd, static_cast<off_t>(m_size)) < 0) {
+    throw std::runtime_error("ftruncate: failed to size pool");
+  }
+  m_data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (m_data == MAP_FAILED) {
+    m_data = nullptr;
+    throw std::runtime_error("mmap: failed to map pool");
+  }
+  m_pool = wl_shm_create_pool(m_shm, m_fd, static_cast<std::int32_t>(m_size));
+  if (!m_pool) {
+    throw std::runtime_error("wl_shm_pool: failed to create pool");
+  }
+
+  static const wl_buffer_listener buffer_listener{on_buffer_release};
+  auto *data = static_cast<std::uint8_t *>(m_data);
+  for (std::size_t i = 0; i < k_buffer_count; ++i) {
+    auto &slot = m_slots[i];
+    slot.buffer = wl_shm_pool_create_buffer(
+        m_pool, static_cast<std::int32_t>(i * buffer_size), m_width,
+        m_height, static_cast<std::int32_t>(stride), WL_SHM_FORMAT_XRGB8888);
+    if (!slot.buffer) {
+      throw std::runtime_error("wl_buffer: failed to create buffer");
+    }
+    wl_buffer_add_listener(slot.buffer, &buffer_listener, this);
+    slot.pixels = reinterpret_cast<std::uint32_t *>(data + i * buffer_size);
+  }
+}
+
+void ShmSwapchain::destroy_buffers() {
+  for (auto &slot : m_slots) {
+    if (!slot.buffer) {
+      continue;
+    }
+    // The compositor may still be reading a busy buffer, so orphan it and
+    // destroy it on release. It keeps its own mapping of the pool.
+    if (slot.busy) {
+      wl_buffer_set_user_data(slot.buffer, nullptr);
+    } else {
+      wl_buffer_destroy(slot.buffer);
+    }
+    slot = {};
+  }
+  m_acquired = nullptr;
+
+  if (m_pool) {
+    wl_shm_pool_destroy(m_pool);
+    m_pool = nullptr;
+  }
+  if (m_data) {
+    munmap(m_data, m_size);
+    m_data = nullptr;
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+void ShmSwapchain::resize(std::int32_t width, std::int32_t height) {
+  if (width == m_width && height == m_height) {
+    return;
+  }
+  destroy_buffers();
+  m_width = width;
+  m_height = height;
+  create_buffers();
+}
+
+PixelBuffer ShmSwapchain::acquire() {
+  // Prefer the most recently presented buffer, as it needs the least
+  // redrawing.
+  if (!m_acquired) {
+    for (auto &slot : m_slots) {
+      if (!slot.busy && (!m_acquired || slot.presented_frame >
+                                            m_acquired->presented_frame)) {
+        m_acquired = &slot;
+      }
+    }
+  }
+  if (!m_acquired) {
+    return {};
+  }
+
+  PixelBuffer buffer;
+  buffer.pixels = m_acquired->pixels;
+  buffer.width = m_width;
+  buffer.height = m_height;
+  buffer.stride = m_width;
+  if (m_acquired->presented_frame != 0) {
+    buffer.age =
+        static_cast<std::int32_t>(m_frame - m_acquired->presented_frame + 1);
+  }
+  return buffer;
+}
+
+wl_buffer *ShmSwapchain::present() {
+  if (!m_acquired) {
+    throw std::runtime_error("wl_shm: no buffer acquired to present");
+  }
+  m_acquired->busy = true;
+  m_acquired->presented_frame = ++m_frame;
+  return std::exchange(m_acquired, nullptr)->buffer;
+}
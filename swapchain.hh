@@ -0,0 +1,78 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+struct wl_buffer;
+struct wl_shm;
+struct wl_shm_pool;
+
+// Pixels of a wl_shm buffer, mapped for direct CPU rendering. Pixels are
+// XRGB8888, in rows of stride pixels.
+struct PixelBuffer {
+  std::uint32_t *pixels{nullptr};
+  std::int32_t width{0};
+  std::int32_t height{0};
+  std::int32_t stride{0};
+  // The number of frames ago that these pixels were presented, or 0 if
+  // they're undefined. As EGL_EXT_buffer_age.
+  std::int32_t age{0};
+};
+
+// A fixed set of wl_shm buffers sub-allocated from a single memfd-backed
+// pool. Buffers are handed out again once the compositor releases them, so
+// no memory is allocated per frame.
+class ShmSwapchain {
+  static constexpr std::size_t k_buffer_count = 3;
+
+  struct Slot {
+    wl_buffer *buffer{nullptr};
+    std::uint32_t *pixels{nullptr};
+    std::uint64_t presented_frame{0};
+    bool busy{false};
+  };
+
+  wl_shm *m_shm;
+  wl_shm_pool *m_pool{nullptr};
+  int m_fd{-1};
+  void *m_data{nullptr};
+  std::size_t m_size{0};
+
+  std::array<Slot, k_buffer_count> m_slots{};
+  Slot *m_acquired{nullptr};
+  std::uint64_t m_frame{0};
+
+  std::int32_t m_width{0};
+  std::int32_t m_height{0};
+
+  // wl_buffer callbacks
+  static void on_buffer_release(void *, wl_buffer *) noexcept;
+
+  void create_buffers();
+  void destroy_buffers();
+
+public:
+  ShmSwapchain(wl_shm *shm, std::int32_t width, std::int32_t height);
+  ShmSwapchain(const ShmSwapchain &) = delete;
+  ShmSwapchain(ShmSwapchain &&) = delete;
+  ~ShmSwapchain();
+
+  // Reallocates the pool for a new size. Buffers still held by the
+  // compositor are destroyed once released.
+  void resize(std::int32_t width, std::int32_t height);
+
+  // Returns a buffer the compositor isn't using, or one with null pixels if
+  // all of them are busy.
+  PixelBuffer acquire();
+  // Marks the acquired buffer as busy and returns it, ready to attach.
+  wl_buffer *present();
+  // Whether a buffer is acquired and not yet presented. Resizing releases
+  // it.
+  bool has_acquired() const { return m_acquired != nullptr; }
+
+  std::int32_t width() const { return m_width; }
+  std::int32_t height() const { return m_height; }
+};
@@ -0,0 +1,130 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "thread_pool.hh"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t threads) {
+  threads = std::max<std::size_t>(threads, 1);
+  for (std::size_t i = 0; i < threads; ++i) {
+    m_queues.push_back(std::make_unique<Queue>());
+  }
+  // The caller of run() works from queue 0.
+  for (std::size_t i = 1; i < threads; ++i) {
+    m_threads.emplace_back(&ThreadPool::worker, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(m_mutex);
+    m_stopping = true;
+  }
+  m_start.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void ThreadPool::worker(std::size_t index) {
+  std::uint64_t generation = 0;
+  for (;;) {
+    void (*task)(void *, std::size_t);
+    void *data;
+    {
+      std::unique_lock lock(m_mutex);
+      m_start.wait(lock, [&] {
+        return m_stopping || m_generation != generation;
+      });
+      if (m_stopping) {
+        return;
+      }
+      generation = m_generation;
+      task = m_task;
+      data = m_task_data;
+      ++m_active;
+    }
+    drain(index, generation, task, data);
+    {
+      std::lock_guard lock(m_mutex);
+      --m_active;
+    }
+    m_done.notify_all();
+  }
+}
+
+void ThreadPool::drain(std::size_t index, std::uint64_t generation,
+                       void (*task)(void *, std::size_t), void *data) {
+  std::uint32_t item;
+  while (pop(index, generation, item) || steal(index, generation, item)) {
+    task(data, item);
+    if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::lock_guard lock(m_mutex);
+      m_done.notify_all();
+    }
+  }
+}
+
+bool ThreadPool::pop(std::size_t index, std::uint64_t generation,
+                     std::uint32_t &item) {
+  auto &queue = *m_queues[index];
+  std::lock_guard lock(queue.mutex);
+  if (queue.generation != generation || queue.head == queue.tail) {
+    return false;
+  }
+  item = queue.items[--queue.tail];
+  return true;
+}
+
+bool ThreadPool::steal(std::size_t index, std::uint64_t generation,
+                       std::uint32_t &item) {
+  for (std::size_t i = 1; i < m_queues.size(); ++i) {
+    auto &queue = *m_queues[(index + i) % m_queues.size()];
+    std::lock_guard lock(queue.mutex);
+    if (queue.generation == generation && queue.head != queue.tail) {
+      item = queue.items[queue.head++];
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::run_tasks(std::size_t count,
+                           void (*task)(void *, std::size_t), void *data) {
+  if (count == 0) {
+    return;
+  }
+
+  // Hand each thread a contiguous run of tasks, so neighbouring tiles stay
+  // on the same core unless they're stolen.
+  std::uint64_t generation;
+  {
+    std::lock_guard lock(m_mutex);
+    generation = m_generation + 1;
+    const std::size_t threads = m_queues.size();
+    for (std::size_t i = 0; i < threads; ++i) {
+      auto &queue = *m_queues[i];
+      const std::size_t begin = count * i / threads;
+      const std::size_t end = count * (i + 1) / threads;
+      std::lock_guard queue_lock(queue.mutex);
+      queue.items.resize(std::max(queue.items.size(), end - begin));
+      for (std::size_t j = begin; j < end; ++j) {
+        queue.items[j - begin] = static_cast<std::uint32_t>(j);
+      }
+      queue.head = 0;
+      queue.tail = end - begin;
+      queue.generation = generation;
+    }
+    m_task = task;
+    m_task_data = data;
+    m_remaining.store(count, std::memory_order_relaxed);
+    m_generation = generation;
+  }
+  m_start.notify_all();
+
+  drain(0, generation, task, data);
+  std::unique_lock lock(m_mutex);
+  m_done.wait(lock, [&] {
+    return m_remaining.load(std::memory_order_acquire) == 0 && m_active == 0;
+  });
+}
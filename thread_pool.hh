@@ -0,0 +1,79 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads for running a batch of independent tasks.
+// Tasks are split between per-thread queues up front, and threads that run
+// out of work steal from the others, so uneven tasks still balance out.
+class ThreadPool {
+  // Indices are taken from the back by the owner and the front by thieves.
+  struct Queue {
+    std::mutex mutex;
+    std::vector<std::uint32_t> items;
+    std::size_t head{0};
+    std::size_t tail{0};
+    // The batch the items belong to. A worker only takes items from the
+    // batch it was woken for.
+    std::uint64_t generation{0};
+  };
+
+  std::vector<std::thread> m_threads;
+  // One per worker, plus one for the thread calling run().
+  std::vector<std::unique_ptr<Queue>> m_queues;
+
+  std::mutex m_mutex;
+  std::condition_variable m_start;
+  std::condition_variable m_done;
+  // The queues, task, data and remaining count are all published together
+  // under m_mutex, along with a new generation. A worker copies the task and
+  // data under the same lock, so it always runs a batch's items with that
+  // batch's task, however late it wakes.
+  std::uint64_t m_generation{0};
+  // Workers inside drain(). run() doesn't return until this is zero, so the
+  // task's data outlives every call to it.
+  std::size_t m_active{0};
+  bool m_stopping{false};
+
+  void (*m_task)(void *, std::size_t){nullptr};
+  void *m_task_data{nullptr};
+  std::atomic<std::size_t> m_remaining{0};
+
+  void worker(std::size_t index);
+  void drain(std::size_t index, std::uint64_t generation,
+             void (*task)(void *, std::size_t), void *data);
+  bool pop(std::size_t index, std::uint64_t generation, std::uint32_t &item);
+  bool steal(std::size_t index, std::uint64_t generation,
+             std::uint32_t &item);
+  void run_tasks(std::size_t count, void (*task)(void *, std::size_t),
+                 void *data);
+
+public:
+  // Defaults to one thread per core, counting the caller of run().
+  explicit ThreadPool(
+      std::size_t threads = std::thread::hardware_concurrency());
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ~ThreadPool();
+
+  // Calls task(i) for every i in [0, count) across the pool, including the
+  // calling thread, and returns once they have all finished.
+  template <typename F> void run(std::size_t count, F &&task) {
+    using Task = std::remove_reference_t<F>;
+    run_tasks(
+        count,
+        [](void *data, std::size_t i) { (*static_cast<Task *>(data))(i); },
+        const_cast<void *>(static_cast<const void *>(&task)));
+  }
+
+  std::size_t size() const { return m_queues.size(); }
+};
@@ -0,0 +1,113 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#include "tile_renderer.hh"
+
+#include <algorithm>
+
+TileRenderer::TileRenderer(std::size_t threads) : m_pool(threads) {}
+
+void TileRenderer::resize(std::int32_t width, std::int32_t height) {
+  m_width = width;
+  m_height = height;
+  m_columns = (width + k_tile_size - 1) / k_tile_size;
+  m_rows = (height + k_tile_size - 1) / k_tile_size;
+
+  // Every buffer's contents are now meaningless.
+  const auto count = static_cast<std::size_t>(m_columns) * m_rows;
+  m_damage.assign(count, 1);
+  for (auto &history : m_history) {
+    history.assign(count, 1);
+  }
+  m_tiles.reserve(count);
+  m_rects.reserve(static_cast<std::size_t>(m_rows) * m_columns);
+}
+
+void TileRenderer::damage(const Rect &rect) {
+  const std::int32_t x0 = std::max(rect.x, 0) / k_tile_size;
+  const std::int32_t y0 = std::max(rect.y, 0) / k_tile_size;
+  const std::int32_t x1 = std::min(
+      (rect.x + rect.width + k_tile_size - 1) / k_tile_size, m_columns);
+  const std::int32_t y1 = std::min(
+      (rect.y + rect.height + k_tile_size - 1) / k_tile_size, m_rows);
+  for (std::int32_t row = y0; row < y1; ++row) {
+    for (std::int32_t column = x0; column < x1; ++column) {
+      m_damage[static_cast<std::size_t>(row) * m_columns + column] = 1;
+    }
+  }
+}
+
+void TileRenderer::damage_all() {
+  std::fill(m_damage.begin(), m_damage.end(), 1);
+}
+
+void TileRenderer::prepare(const PixelBuffer &buffer) {
+  if (buffer.width != m_width || buffer.height != m_height) {
+    resize(buffer.width, buffer.height);
+  }
+  m_tiles.clear();
+  m_rects.clear();
+
+  // If nothing changed, leave any stale tiles in this buffer until there's
+  // something to present, as history only advances with presented frames.
+  if (std::find(m_damage.begin(), m_damage.end(), 1) == m_damage.end()) {
+    return;
+  }
+
+  // Besides this frame's damage, the buffer is missing whatever was drawn
+  // in the frames since it was last presented.
+  const bool all = buffer.age <= 0 ||
+                   static_cast<std::size_t>(buffer.age) - 1 > k_history;
+  const std::size_t missed = all ? 0 : static_cast<std::size_t>(buffer.age) - 1;
+  for (std::size_t tile = 0; tile < m_damage.size(); ++tile) {
+    bool stale = all || m_damage[tile];
+    for (std::size_t frame = 0; !stale && frame < missed; ++frame) {
+      stale = m_history[frame][tile];
+    }
+    if (stale) {
+      m_tiles.push_back(static_cast<std::uint32_t>(tile));
+    }
+  }
+
+  // Only this frame's damage is news to the compositor. Runs of damaged
+  // tiles along a row become one rectangle.
+  for (std::int32_t row = 0; row < m_rows; ++row) {
+    const auto *flags = &m_damage[static_cast<std::size_t>(row) * m_columns];
+    for (std::int32_t column = 0; column < m_columns;) {
+      if (!flags[column]) {
+        ++column;
+        continue;
+      }
+      const std::int32_t start = column;
+      while (column < m_columns && flags[column]) {
+        ++column;
+      }
+      Rect rect;
+      rect.x = start * k_tile_size;
+      rect.y = row * k_tile_size;
+      rect.width = std::min(column * k_tile_size, m_width) - rect.x;
+      rect.height = std::min(rect.y + k_tile_size, m_height) - rect.y;
+      m_rects.push_back(rect);
+    }
+  }
+
+  std::rotate(m_history.rbegin(), m_history.rbegin() + 1, m_history.rend());
+  m_history[0].swap(m_damage);
+  std::fill(m_damage.begin(), m_damage.end(), 0);
+}
+
+PixelBuffer TileRenderer::tile_pixels(const PixelBuffer &buffer,
+                                      std::uint32_t tile, Rect &bounds) const {
+  const auto column = static_cast<std::int32_t>(tile) % m_columns;
+  const auto row = static_cast<std::int32_t>(tile) / m_columns;
+  bounds.x = column * k_tile_size;
+  bounds.y = row * k_tile_size;
+  bounds.width = std::min(k_tile_size, m_width - bounds.x);
+  bounds.height = std::min(k_tile_size, m_height - bounds.y);
+
+  PixelBuffer pixels = buffer;
+  pixels.pixels +=
+      static_cast<std::size_t>(bounds.y) * buffer.stride + bounds.x;
+  pixels.width = bounds.width;
+  pixels.height = bounds.height;
+  return pixels;
+}
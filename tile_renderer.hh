@@ -0,0 +1,67 @@
+// SPDX-FileCopyrightText: 2024 Matthew Smith <matthew@matthew.as>
+// SPDX-License-Identifier: GPL-3.0-or-later
+#pragma once
+
+#include "rect.hh"
+#include "swapchain.hh"
+#include "thread_pool.hh"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Software rendering split into square tiles, small enough that a tile's
+// pixels stay in cache while it's drawn. Only damaged tiles are drawn, in
+// parallel, and their bounds are returned for the compositor.
+class TileRenderer {
+public:
+  static constexpr std::int32_t k_tile_size = 64;
+
+private:
+  // Enough to cover the age of any buffer in the swapchain.
+  static constexpr std::size_t k_history = 4;
+
+  ThreadPool m_pool;
+  std::int32_t m_width{0};
+  std::int32_t m_height{0};
+  std::int32_t m_columns{0};
+  std::int32_t m_rows{0};
+
+  // One flag per tile: damage for the next frame, then for recent frames,
+  // newest first.
+  std::vector<std::uint8_t> m_damage;
+  std::array<std::vector<std::uint8_t>, k_history> m_history;
+
+  // Per-frame scratch, kept to avoid allocating.
+  std::vector<std::uint32_t> m_tiles;
+  std::vector<Rect> m_rects;
+
+  void resize(std::int32_t width, std::int32_t height);
+  void prepare(const PixelBuffer &buffer);
+  PixelBuffer tile_pixels(const PixelBuffer &buffer, std::uint32_t tile,
+                          Rect &bounds) const;
+
+public:
+  explicit TileRenderer(
+      std::size_t threads = std::thread::hardware_concurrency());
+
+  // Marks part of the surface as needing to be redrawn.
+  void damage(const Rect &rect);
+  void damage_all();
+
+  // Calls draw(tile, bounds) for each tile that needs to be redrawn in
+  // buffer, in parallel. tile views the pixels within bounds. Returns the
+  // damage to report to the compositor, which is empty if nothing changed.
+  template <typename F>
+  std::span<const Rect> render(const PixelBuffer &buffer, F &&draw) {
+    prepare(buffer);
+    m_pool.run(m_tiles.size(), [&](std::size_t i) {
+      Rect bounds;
+      const PixelBuffer tile = tile_pixels(buffer, m_tiles[i], bounds);
+      draw(tile, bounds);
+    });
+    return m_rects;
+  }
+};
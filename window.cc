@@ -4,60 +4,61 @@
 
 #include <wayland-client.h>
 #include <wayland-egl.h>
+#include <wayland-fractional-scale-v1-client-protocol.h>
+#include <wayland-pointer-constraints-client-protocol.h>
+#include <wayland-presentation-time-client-protocol.h>
+#include <wayland-single-pixel-buffer-v1-client-protocol.h>
 #include <wayland-util.h>
+#include <wayland-viewporter-client-protocol.h>
 #include <wayland-xdg-decoration-client-protocol.h>
 #include <wayland-xdg-shell-client-protocol.h>
-#include <xkbcommon/xkbcommon.h>
 
 #include <EGL/egl.h> // must be included after wayland-egl.h
+#include <EGL/eglext.h>
 
+#include <algorithm>
+#include <array>
+#include <mutex>
 #include <span>
 #include <stdexcept>
-#include <string_view> // IWYU pragma: no_include <string>
 #include <utility>
 
-#include <sys/mman.h>
-#include <unistd.h>
+#include <time.h>
 
 // TODO: Make parameter to Window::Window.
 static const char *k_title = "wlhello";
 static const std::int32_t k_width = 800;
 static const std::int32_t k_height = 600;
 
-Window::Window() {
-  // Connect to display.
-  m_display = wl_display_connect(nullptr);
-  if (!m_display) {
-    throw std::runtime_error(
-        "wl_display_connect: failed to connect to display");
-  }
-
-  // Get registry and bind globals.
-  m_registry = wl_display_get_registry(m_display);
-  static const wl_registry_listener registry_listener{
-      on_registry_global, on_registry_global_remove};
-  wl_registry_add_listener(m_registry, &registry_listener, this);
-  wl_display_dispatch(m_display);
-  wl_display_roundtrip(m_display);
-
-  // Check for required globals.
-  if (!m_compositor) {
-    throw std::runtime_error("wl_compositor: failed to bind global");
-  }
-  if (!m_seat) {
-    throw std::runtime_error("wl_seat: failed to bind global");
-  }
-  if (!m_wm_base) {
-    throw std::runtime_error("xdg_wm_base: failed to bind global");
-  }
-  // zxdg_decoration_manager_v1 is optional.
+static std::uint64_t clock_now(std::uint32_t clock_id) {
+  timespec ts;
+  clock_gettime(static_cast<clockid_t>(clock_id), &ts);
+  return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 +
+         static_cast<std::uint64_t>(ts.tv_nsec);
+}
 
+Window::Window(Display &display) : m_display(display) {
   // Create surface.
-  m_surface = wl_compositor_create_surface(m_compositor);
+  m_surface = wl_compositor_create_surface(m_display.m_compositor);
   if (!m_surface) {
     throw std::runtime_error("wl_surface: failed to create surface");
   }
-  m_xdg_surface = xdg_wm_base_get_xdg_surface(m_wm_base, m_surface);
+  // So that input events can find their window.
+  wl_surface_set_user_data(m_surface, this);
+  // The buffer can only be sized apart from the surface with a viewport.
+  if (m_display.m_fractional_scale_manager && m_display.m_viewporter) {
+    m_fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+        m_display.m_fractional_scale_manager, m_surface);
+    static const wp_fractional_scale_v1_listener fractional_scale_listener{
+        on_preferred_scale};
+    wp_fractional_scale_v1_add_listener(m_fractional_scale,
+                                        &fractional_scale_listener, this);
+    m_viewport = wp_viewporter_get_viewport(m_display.m_viewporter, m_surface);
+  }
+  // The xdg objects are created on the event thread's queue, if there is
+  // one, so hold it off until they have listeners.
+  std::unique_lock lock(m_display.m_dispatch_mutex);
+  m_xdg_surface = xdg_wm_base_get_xdg_surface(m_display.m_wm_base, m_surface);
   if (!m_xdg_surface) {
     throw std::runtime_error("xdg_surface: failed to get surface");
   }
@@ -70,14 +71,16 @@ Window::Window() {
   }
   xdg_toplevel_set_title(m_xdg_toplevel, k_title);
   static const xdg_toplevel_listener xdg_toplevel_listener{
-      on_xdg_toplevel_configure, on_xdg_toplevel_close, nullptr, nullptr};
+      on_xdg_toplevel_configure, on_xdg_toplevel_close,
+      on_xdg_toplevel_configure_bounds, on_xdg_toplevel_wm_capabilities};
   xdg_toplevel_add_listener(m_xdg_toplevel, &xdg_toplevel_listener, this);
+  lock.unlock();
 
   // If decoration manager protocol is supported, enable server-side
   // decoration.
-  if (m_decoration_manager) {
+  if (m_display.m_decoration_manager) {
     m_toplevel_decoration = zxdg_decoration_manager_v1_get_toplevel_decoration(
-        m_decoration_manager, m_xdg_toplevel);
+        m_display.m_decoration_manager, m_xdg_toplevel);
     zxdg_toplevel_decoration_v1_set_mode(
         m_toplevel_decoration, ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
   }
@@ -87,241 +90,609 @@ Window::Window() {
   // Create a window.
   m_width = k_width;
   m_height = k_height;
-  m_region = wl_compositor_create_region(m_compositor);
+  m_buffer_width = k_width;
+  m_buffer_height = k_height;
+  if (m_fractional_scale) {
+    wp_viewport_set_destination(m_viewport, m_width, m_height);
+  }
+  m_region = wl_compositor_create_region(m_display.m_compositor);
   if (!m_region) {
     throw std::runtime_error("wl_region: failed to create region");
   }
   wl_region_add(m_region, 0, 0, m_width, m_height);
   wl_surface_set_opaque_region(m_surface, m_region);
+}
 
-  // Create an xkb context.
-  m_xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-  if (!m_xkb_context) {
-    throw std::runtime_error("xkb_context_new: failed to create context");
+Window::~Window() {
+  // EGL
+  if (m_egl_context) {
+    const EGLDisplay egl_display = m_display.m_egl_display;
+    if (eglGetCurrentContext() == m_egl_context) {
+      eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                     EGL_NO_CONTEXT);
+    }
+    eglDestroyContext(egl_display, m_egl_context);
+    eglDestroySurface(egl_display, m_egl_surface);
   }
-
-  // Create EGL context.
-  m_egl_window = wl_egl_window_create(m_surface, m_width, m_height);
-  if (!m_egl_window) {
-    throw std::runtime_error("wl_egl_window: failed to create window");
+  if (m_egl_window) {
+    wl_egl_window_destroy(m_egl_window);
   }
-  m_egl_display = eglGetDisplay(m_display);
-  if (!m_egl_display) {
-    throw std::runtime_error("egl_display: failed to get display");
-  }
-  EGLint egl_major;
-  EGLint egl_minor;
-  if (!eglInitialize(m_egl_display, &egl_major, &egl_minor)) {
-    throw std::runtime_error("egl: failed to initialise");
-  }
-  static const EGLint egl_attrs[] = {
-      EGL_RED_SIZE,  8, EGL_GREEN_SIZE,      8,
-      EGL_BLUE_SIZE, 8, EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
-      EGL_NONE};
-  EGLint num_configs;
-  EGLConfig egl_config;
-  if (!eglChooseConfig(m_egl_display, egl_attrs, &egl_config, 1,
-                       &num_configs)) {
-    throw std::runtime_error("egl_config: failed to choose config");
-  }
-  m_egl_surface =
-      eglCreateWindowSurface(m_egl_display, egl_config, m_egl_window, nullptr);
-  static const EGLint ctx_attrs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
-  m_egl_context =
-      eglCreateContext(m_egl_display, egl_config, EGL_NO_CONTEXT, ctx_attrs);
-  if (!m_egl_context) {
-    throw std::runtime_error("egl_context: failed to create context");
+
+  // Software rendering
+  m_swapchain.reset();
+
+  // pointer-constraints
+  if (m_locked_pointer) {
+    zwp_locked_pointer_v1_destroy(m_locked_pointer);
   }
-}
 
-Window::~Window() {
-  // EGL
-  eglDestroyContext(m_egl_display, m_egl_context);
-  eglDestroySurface(m_egl_display, m_egl_surface);
-  eglTerminate(m_egl_display);
-  wl_egl_window_destroy(m_egl_window);
+  // fractional-scale
+  if (m_fractional_scale) {
+    wp_fractional_scale_v1_destroy(m_fractional_scale);
+  }
 
-  // xkbcommon
-  xkb_keymap_unref(m_xkb_keymap);
-  xkb_state_unref(m_xkb_state);
-  xkb_context_unref(m_xkb_context);
+  // single-pixel-buffer and viewporter
+  if (m_solid_buffer) {
+    wl_buffer_destroy(m_solid_buffer);
+  }
+  if (m_viewport) {
+    wp_viewport_destroy(m_viewport);
+  }
 
   // other wayland objects
-  zxdg_toplevel_decoration_v1_destroy(m_toplevel_decoration);
-  xdg_toplevel_destroy(m_xdg_toplevel);
-  xdg_surface_destroy(m_xdg_surface);
+  for (auto &pending : m_pending_feedback) {
+    if (pending.feedback) {
+      wp_presentation_feedback_destroy(pending.feedback);
+    }
+  }
+  if (m_frame_callback) {
+    wl_callback_destroy(m_frame_callback);
+  }
+  if (m_toplevel_decoration) {
+    zxdg_toplevel_decoration_v1_destroy(m_toplevel_decoration);
+  }
+  {
+    // Once the xdg objects are gone and the surface no longer leads back
+    // here, nothing more can be published for this window. Enter events for
+    // the surface find no window.
+    const std::lock_guard lock(m_display.m_dispatch_mutex);
+    xdg_toplevel_destroy(m_xdg_toplevel);
+    xdg_surface_destroy(m_xdg_surface);
+    wl_surface_set_user_data(m_surface, nullptr);
+  }
+  m_display.forget_window(this);
   wl_surface_destroy(m_surface);
-  wl_keyboard_release(m_keyboard);
   wl_region_destroy(m_region);
+}
 
-  // wayland globals
-  zxdg_decoration_manager_v1_destroy(m_decoration_manager);
-  xdg_wm_base_destroy(m_wm_base);
-  wl_seat_destroy(m_seat);
-  wl_compositor_destroy(m_compositor);
-  wl_registry_destroy(m_registry);
-
-  wl_display_disconnect(m_display);
+void Window::on_frame_done(void *window_ptr, wl_callback *callback,
+                           std::uint32_t /* time */) noexcept {
+  auto &window = *static_cast<Window *>(window_ptr);
+  wl_callback_destroy(callback);
+  window.m_frame_callback = nullptr;
 }
 
-void Window::on_registry_global(void *window_ptr, wl_registry *registry,
-                                std::uint32_t id, const char *interface_ptr,
-                                std::uint32_t /* name */) noexcept {
+void Window::on_xdg_surface_configure(void *window_ptr, xdg_surface *,
+                                      std::uint32_t serial) noexcept {
   auto &window = *static_cast<Window *>(window_ptr);
-  std::string_view interface = interface_ptr;
-
-  if (interface == wl_compositor_interface.name) {
-    window.m_compositor = static_cast<wl_compositor *>(
-        wl_registry_bind(registry, id, &wl_compositor_interface, 1));
-  } else if (interface == xdg_wm_base_interface.name) {
-    window.m_wm_base = static_cast<xdg_wm_base *>(
-        wl_registry_bind(registry, id, &xdg_wm_base_interface, 1));
-    static const xdg_wm_base_listener xdg_base_listener{on_wm_base_ping};
-    xdg_wm_base_add_listener(window.m_wm_base, &xdg_base_listener, window_ptr);
-  } else if (interface == wl_seat_interface.name) {
-    static const wl_seat_listener wl_seat_listener{on_seat_capabilities,
-                                                   on_seat_name};
-    window.m_seat = static_cast<wl_seat *>(
-        wl_registry_bind(registry, id, &wl_seat_interface, 7));
-    wl_seat_add_listener(window.m_seat, &wl_seat_listener, window_ptr);
-  } else if (interface == zxdg_decoration_manager_v1_interface.name) {
-    window.m_decoration_manager =
-        static_cast<zxdg_decoration_manager_v1 *>(wl_registry_bind(
-            registry, id, &zxdg_decoration_manager_v1_interface, 1));
-  }
-}
-
-void Window::on_registry_global_remove(void * /* window_ptr */,
-                                       wl_registry * /* registry */,
-                                       std::uint32_t /* name */) noexcept {}
-
-void Window::on_seat_capabilities(void *window_ptr, wl_seat *seat,
-                                  std::uint32_t capabilities) noexcept {
+
+  // Toplevel configures arrive in bursts while resizing, so only act on the
+  // final size of each configure sequence.
+  window.m_display.publish({.type = Display::Event::Type::configure,
+                            .window = &window,
+                            .serial = serial,
+                            .width = window.m_pending_width,
+                            .height = window.m_pending_height,
+                            .states = window.m_pending_states});
+}
+
+void Window::on_xdg_toplevel_configure(void *window_ptr, xdg_toplevel *,
+                                       std::int32_t width, std::int32_t height,
+                                       wl_array *states_array) noexcept {
   auto &window = *static_cast<Window *>(window_ptr);
-  const bool had_keyboard = window.m_keyboard != nullptr;
-  const bool has_keyboard = (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) != 0;
-  if (has_keyboard && !had_keyboard) {
-    window.m_keyboard = wl_seat_get_keyboard(seat);
-    static const wl_keyboard_listener wl_keyboard_listener{
-        on_keyboard_map, on_keyboard_enter, on_keyboard_leave,
-        on_keyboard_key, on_keyboard_mod,   on_keyboard_repeat_info};
-    wl_keyboard_add_listener(window.m_keyboard, &wl_keyboard_listener,
-                             window_ptr);
-  } else if (!has_keyboard && had_keyboard) {
-    wl_keyboard_release(std::exchange(window.m_keyboard, nullptr));
+  window.m_pending_width = width;
+  window.m_pending_height = height;
+  const std::span<const std::uint32_t> states(
+      static_cast<const std::uint32_t *>(states_array->data),
+      states_array->size / sizeof(std::uint32_t));
+  window.m_pending_states = 0;
+  for (const std::uint32_t state : states) {
+    if (state < 32) {
+      window.m_pending_states |= 1u << state;
+    }
   }
 }
 
-void Window::on_xdg_surface_configure(void *, xdg_surface *xdg_surface,
-                                      std::uint32_t serial) noexcept {
-  xdg_surface_ack_configure(xdg_surface, serial);
+void Window::on_preferred_scale(void *window_ptr,
+                                wp_fractional_scale_v1 * /* fractional_scale */,
+                                std::uint32_t scale) noexcept {
+  auto &window = *static_cast<Window *>(window_ptr);
+  if (scale > 0 && scale != window.m_scale) {
+    window.m_scale = scale;
+    window.resize_buffer();
+  }
 }
 
-void Window::on_xdg_toplevel_configure(void *, xdg_toplevel *, std::int32_t,
-                                       std::int32_t, wl_array *) noexcept {}
-
 void Window::on_xdg_toplevel_close(void *window_ptr, xdg_toplevel *) noexcept {
   auto &window = *static_cast<Window *>(window_ptr);
-  window.m_wants_close = true;
+  window.m_display.publish(
+      {.type = Display::Event::Type::close, .window = &window});
 }
 
-void Window::on_keyboard_map(void *window_ptr, wl_keyboard * /* keyboard */,
-                             std::uint32_t /* format */, std::int32_t fd,
-                             std::uint32_t size) noexcept {
-  // TODO(correctness): Check format is WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1.
-  // TODO(correctness): Check mmap success.
+void Window::on_xdg_toplevel_configure_bounds(
+    void * /* window_ptr */, xdg_toplevel * /* toplevel */,
+    std::int32_t /* width */, std::int32_t /* height */) noexcept {}
+
+void Window::on_xdg_toplevel_wm_capabilities(
+    void * /* window_ptr */, xdg_toplevel * /* toplevel */,
+    wl_array * /* capabilities */) noexcept {}
+
+// Unlike other Wayland types, wp_presentation_feedback needs its struct
+// keyword here: the request function of the same name, from
+// wayland-presentation-time-client-protocol.h, hides the bare type name.
+void Window::on_feedback_sync_output(
+    void * /* window_ptr */, struct wp_presentation_feedback * /* feedback */,
+    wl_output * /* output */) noexcept {}
+
+void Window::on_feedback_presented(
+    void *window_ptr, struct wp_presentation_feedback *feedback,
+    std::uint32_t tv_sec_hi, std::uint32_t tv_sec_lo, std::uint32_t tv_nsec,
+    std::uint32_t refresh, std::uint32_t seq_hi, std::uint32_t seq_lo,
+    std::uint32_t flags) noexcept {
+  auto &window = *static_cast<Window *>(window_ptr);
+  auto *pending = window.find_pending_feedback(feedback);
+
+  const std::uint64_t tv_sec =
+      (static_cast<std::uint64_t>(tv_sec_hi) << 32) | tv_sec_lo;
+  auto &presentation = window.m_last_presentation;
+  presentation.frame = pending->frame;
+  presentation.commit_time = pending->commit_time;
+  presentation.present_time = tv_sec * 1'000'000'000 + tv_nsec;
+  presentation.refresh = refresh;
+  presentation.sequence = (static_cast<std::uint64_t>(seq_hi) << 32) | seq_lo;
+  presentation.vsync = (flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) != 0;
+  presentation.hw_clock = (flags & WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK) != 0;
+  presentation.hw_completion =
+      (flags & WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION) != 0;
+  presentation.zero_copy =
+      (flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY) != 0;
+
+  wp_presentation_feedback_destroy(feedback);
+  *pending = {};
+}
 
+void Window::on_feedback_discarded(
+    void *window_ptr, struct wp_presentation_feedback *feedback) noexcept {
   auto &window = *static_cast<Window *>(window_ptr);
+  ++window.m_frames_discarded;
+  *window.find_pending_feedback(feedback) = {};
+  wp_presentation_feedback_destroy(feedback);
+}
 
-  void *shm = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
-  xkb_keymap *xkb_keymap = xkb_keymap_new_from_string(
-      window.m_xkb_context, static_cast<const char *>(shm),
-      XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
-  munmap(shm, size);
-  close(fd);
+void Window::configure(std::uint32_t serial, std::int32_t width,
+                       std::int32_t height, std::uint32_t states) {
+  // A zero size leaves the choice to us, so keep what we have.
+  if (width > 0 && height > 0) {
+    resize(width, height);
+  }
+  xdg_surface_ack_configure(m_xdg_surface, serial);
+  m_configured = true;
+
+  const auto has_state = [states](xdg_toplevel_state state) {
+    return (states & (1u << state)) != 0;
+  };
+  m_maximized = has_state(XDG_TOPLEVEL_STATE_MAXIMIZED);
+  m_fullscreen = has_state(XDG_TOPLEVEL_STATE_FULLSCREEN);
+  m_activated = has_state(XDG_TOPLEVEL_STATE_ACTIVATED);
+  const bool was_suspended =
+      std::exchange(m_suspended, has_state(XDG_TOPLEVEL_STATE_SUSPENDED));
+  // A frame callback requested before suspension may never come, so draw
+  // straight away instead of waiting for it.
+  if (was_suspended && !m_suspended && m_frame_callback) {
+    wl_callback_destroy(std::exchange(m_frame_callback, nullptr));
+  }
 
-  xkb_state *xkb_state = xkb_state_new(xkb_keymap);
-  xkb_keymap_unref(window.m_xkb_keymap);
-  xkb_state_unref(window.m_xkb_state);
-  window.m_xkb_keymap = xkb_keymap;
-  window.m_xkb_state = xkb_state;
+  // Nothing else is going to commit a solid colour surface.
+  if (m_solid_buffer) {
+    commit_solid_color();
+  }
 }
 
-void Window::on_keyboard_enter(void *window_ptr, wl_keyboard *,
-                               std::uint32_t /* serial */,
-                               wl_surface * /* surface */,
-                               wl_array *keys_array) noexcept {
-  auto &window = *static_cast<Window *>(window_ptr);
+void Window::resize(std::int32_t width, std::int32_t height) {
+  if (width == m_width && height == m_height) {
+    return;
+  }
+  m_width = width;
+  m_height = height;
+  if (m_fractional_scale) {
+    wp_viewport_set_destination(m_viewport, m_width, m_height);
+  }
+  resize_buffer();
 
-  const std::span<std::uint32_t> keys(
-      static_cast<std::uint32_t *>(keys_array->data),
-      keys_array->size / sizeof(std::uint32_t));
-  for (auto key : keys) {
-    // Add 8 to convert from an evdev scancode to an xkb scancode.
-    const xkb_keysym_t sym =
-        xkb_state_key_get_one_sym(window.m_xkb_state, key + 8);
+  // The region is copied when set, so build a fresh one rather than editing
+  // the old. Takes effect on the next commit, along with the new buffer.
+  wl_region_destroy(m_region);
+  m_region = wl_compositor_create_region(m_display.m_compositor);
+  wl_region_add(m_region, 0, 0, m_width, m_height);
+  set_opaque(m_opaque);
+}
 
-    // TODO:
-    (void)sym;
-  }
+void Window::set_opaque(bool opaque) {
+  // Without a region, the compositor blends the surface with what's behind.
+  m_opaque = opaque;
+  wl_surface_set_opaque_region(m_surface, m_opaque ? m_region : nullptr);
 }
 
-void Window::on_keyboard_leave(void * /* window_ptr */,
-                               wl_keyboard * /* keyboard */,
-                               std::uint32_t /* serial */,
-                               wl_surface * /* surface */) noexcept {
-  // TODO: Mark all keys as released.
+void Window::resize_buffer() {
+  // Rounded half away from zero, as fractional-scale-v1 asks.
+  const auto scaled = [this](std::int32_t size) {
+    return static_cast<std::int32_t>(
+        (static_cast<std::int64_t>(size) * m_scale + 60) / 120);
+  };
+  const std::int32_t width = m_fractional_scale ? scaled(m_width) : m_width;
+  const std::int32_t height = m_fractional_scale ? scaled(m_height) : m_height;
+  if (width == m_buffer_width && height == m_buffer_height) {
+    return;
+  }
+  m_buffer_width = width;
+  m_buffer_height = height;
+  if (m_egl_window) {
+    wl_egl_window_resize(m_egl_window, m_buffer_width, m_buffer_height, 0, 0);
+  }
+  if (m_swapchain) {
+    m_swapchain->resize(m_buffer_width, m_buffer_height);
+  }
 }
 
-void Window::on_keyboard_key(void *window_ptr, wl_keyboard *,
-                             std::uint32_t /* serial */, std::uint32_t,
-                             std::uint32_t key, std::uint32_t state) noexcept {
-  // Add 8 to convert from an evdev scancode to an xkb scancode.
-  auto &window = *static_cast<Window *>(window_ptr);
+void Window::reset_viewport() {
+  // With fractional scaling, the viewport always maps the buffer onto the
+  // surface. Otherwise, it's only needed for solid colours.
+  if (!m_fractional_scale) {
+    wp_viewport_set_destination(m_viewport, -1, -1);
+  }
+}
 
-  const xkb_keysym_t sym =
-      xkb_state_key_get_one_sym(window.m_xkb_state, key + 8);
-  const bool pressed = state == WL_KEYBOARD_KEY_STATE_PRESSED;
+void Window::init_egl() {
+  if (!m_display.m_egl_display) {
+    m_display.init_egl();
+  }
+  const EGLDisplay egl_display = m_display.m_egl_display;
 
-  // TODO:
-  (void)sym;
-  (void)pressed;
+  m_egl_window =
+      wl_egl_window_create(m_surface, m_buffer_width, m_buffer_height);
+  if (!m_egl_window) {
+    throw std::runtime_error("wl_egl_window: failed to create window");
+  }
+  m_egl_surface = eglCreateWindowSurface(egl_display, m_display.m_egl_config,
+                                         m_egl_window, nullptr);
+  if (!m_egl_surface) {
+    throw std::runtime_error("egl_surface: failed to create surface");
+  }
+  static const EGLint ctx_attrs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+  m_egl_context = eglCreateContext(egl_display, m_display.m_egl_config,
+                                   m_display.m_egl_context, ctx_attrs);
+  if (!m_egl_context) {
+    throw std::runtime_error("egl_context: failed to create context");
+  }
 }
 
-void Window::on_keyboard_mod(void *window_ptr, wl_keyboard * /* keyboard */,
-                             std::uint32_t /* serial */,
-                             std::uint32_t mods_depressed,
-                             std::uint32_t mods_latched,
-                             std::uint32_t mods_locked,
-                             std::uint32_t group) noexcept {
-  auto &window = *static_cast<Window *>(window_ptr);
-  xkb_state_update_mask(window.m_xkb_state, mods_depressed, mods_latched,
-                        mods_locked, 0, 0, group);
+void Window::show_solid_color(float red, float green, float blue,
+                              float alpha) {
+  if (!supports_solid_color()) {
+    throw std::runtime_error(
+        "wp_single_pixel_buffer_manager_v1: solid colours not supported");
+  }
+
+  // Channels are premultiplied and span the full 32-bit range.
+  const auto channel = [](float value) {
+    return static_cast<std::uint32_t>(
+        static_cast<double>(std::clamp(value, 0.f, 1.f)) * UINT32_MAX);
+  };
+  if (m_solid_buffer) {
+    wl_buffer_destroy(m_solid_buffer);
+  }
+  m_solid_buffer = wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+      m_display.m_single_pixel_buffer_manager, channel(red * alpha),
+      channel(green * alpha), channel(blue * alpha), channel(alpha));
+  if (!m_viewport) {
+    m_viewport = wp_viewporter_get_viewport(m_display.m_viewporter, m_surface);
+  }
+  set_opaque(alpha >= 1.f);
+
+  // Buffers can't be attached until the first configure has been acked, in
+  // which case it's committed from there.
+  if (m_configured) {
+    commit_solid_color();
+  }
 }
 
-void Window::on_keyboard_repeat_info(void * /* window_ptr */,
-                                     wl_keyboard * /* keyboard */,
-                                     std::int32_t /* rate */,
-                                     std::int32_t /* delay */) noexcept {
-  // TODO: Store rate and delay for application use.
+void Window::commit_solid_color() {
+  wp_viewport_set_destination(m_viewport, m_width, m_height);
+  wl_surface_attach(m_surface, m_solid_buffer, 0, 0);
+  wl_surface_damage(m_surface, 0, 0, m_width, m_height);
+  wl_surface_commit(m_surface);
 }
 
-void Window::on_seat_name(void * /* window_ptr */, wl_seat * /* seat */,
-                          const char * /* name */) noexcept {}
+bool Window::set_pointer_locked(bool locked) {
+  const std::lock_guard lock(m_display.m_dispatch_mutex);
+  // A lock outlives the pointer it was made on, but no longer does anything,
+  // so drop it as if it had been unlocked.
+  if (m_locked_pointer &&
+      m_locked_pointer_generation != m_display.m_pointer_generation) {
+    zwp_locked_pointer_v1_destroy(std::exchange(m_locked_pointer, nullptr));
+  }
+  if (!locked) {
+    if (m_locked_pointer) {
+      zwp_locked_pointer_v1_destroy(std::exchange(m_locked_pointer, nullptr));
+    }
+    return true;
+  }
+  if (m_locked_pointer) {
+    return true;
+  }
+  if (!m_display.m_pointer_constraints || !m_display.m_pointer) {
+    return false;
+  }
+  m_locked_pointer = zwp_pointer_constraints_v1_lock_pointer(
+      m_display.m_pointer_constraints, m_surface, m_display.m_pointer, nullptr,
+      ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
+  m_locked_pointer_generation = m_display.m_pointer_generation;
+  return m_locked_pointer != nullptr;
+}
 
-void Window::on_wm_base_ping(void * /* window_ptr */, xdg_wm_base *wm_base,
-                             std::uint32_t serial) noexcept {
-  xdg_wm_base_pong(wm_base, serial);
+void Window::set_cursor(Cursor cursor) {
+  if (std::exchange(m_cursor, cursor) != cursor &&
+      m_display.m_pointer_pending.focus == this) {
+    m_display.set_cursor(cursor);
+  }
 }
 
 void Window::make_current() {
-  if (!eglMakeCurrent(m_egl_display, m_egl_surface, m_egl_surface,
+  // EGL is set up lazily, so that windows which never render with it don't
+  // pay for it.
+  if (!m_egl_context) {
+    init_egl();
+  }
+  if (!eglMakeCurrent(m_display.m_egl_display, m_egl_surface, m_egl_surface,
                       m_egl_context)) {
     throw std::runtime_error("eglMakeCurrent");
   }
+  eglSwapInterval(m_display.m_egl_display, m_frame_callbacks ? 0 : 1);
+}
+
+void Window::wait_until_visible() {
+  while (!is_visible() && !m_wants_close) {
+    m_display.wait_events();
+  }
+}
+
+void Window::set_frame_callbacks(bool enabled) {
+  m_frame_callbacks = enabled;
+  // The swap interval applies to the current context, so defer to
+  // make_current() if we aren't it.
+  if (m_egl_context && eglGetCurrentContext() == m_egl_context) {
+    eglSwapInterval(m_display.m_egl_display, m_frame_callbacks ? 0 : 1);
+  }
+}
+
+Window::PendingFeedback *
+Window::find_pending_feedback(struct wp_presentation_feedback *feedback) {
+  for (auto &pending : m_pending_feedback) {
+    if (pending.feedback == feedback) {
+      return &pending;
+    }
+  }
+  return nullptr;
+}
+
+Window::PendingFeedback *Window::request_presentation_feedback() {
+  ++m_frame_count;
+  if (!m_display.m_presentation) {
+    return nullptr;
+  }
+
+  // If the compositor is holding on to a lot of frames, skip feedback for
+  // this one rather than allocating.
+  auto *pending = find_pending_feedback(nullptr);
+  if (!pending) {
+    return nullptr;
+  }
+  pending->feedback =
+      wp_presentation_feedback(m_display.m_presentation, m_surface);
+  pending->frame = m_frame_count;
+  static const wp_presentation_feedback_listener feedback_listener{
+      on_feedback_sync_output, on_feedback_presented, on_feedback_discarded};
+  wp_presentation_feedback_add_listener(pending->feedback, &feedback_listener,
+                                        this);
+  return pending;
+}
+
+void Window::stamp_commit(PendingFeedback *pending) {
+  // Taken after the commit rather than before: a swap can first wait for the
+  // previous frame, which would count against this one's latency.
+  if (pending) {
+    pending->commit_time = clock_now(m_display.m_presentation_clock);
+  }
+}
+
+std::uint64_t Window::predict_next_present() const {
+  const std::uint64_t now = clock_now(m_display.m_presentation_clock);
+  const std::uint64_t last = m_last_presentation.present_time;
+  const std::uint64_t refresh = m_last_presentation.refresh;
+  if (last == 0 || refresh == 0 || now < last) {
+    return now;
+  }
+  // Round up to the first refresh boundary after now.
+  return last + ((now - last) / refresh + 1) * refresh;
+}
+
+std::int32_t Window::buffer_age() const {
+  EGLint age = 0;
+  if (m_display.m_has_buffer_age &&
+      !eglQuerySurface(m_display.m_egl_display, m_egl_surface,
+                       EGL_BUFFER_AGE_EXT, &age)) {
+    return 0;
+  }
+  return age;
+}
+
+Window::PendingFeedback *Window::prepare_commit() {
+  if (m_frame_callbacks) {
+    // If the last frame is still pending, only wait on the newest.
+    if (m_frame_callback) {
+      wl_callback_destroy(m_frame_callback);
+    }
+    m_frame_callback = wl_surface_frame(m_surface);
+    static const wl_callback_listener frame_listener{on_frame_done};
+    wl_callback_add_listener(m_frame_callback, &frame_listener, this);
+  }
+  return request_presentation_feedback();
+}
+
+PixelBuffer Window::acquire_pixels() {
+  if (!m_display.m_shm) {
+    throw std::runtime_error("wl_shm: failed to bind global");
+  }
+  if (!m_swapchain) {
+    m_swapchain =
+        std::make_unique<ShmSwapchain>(m_display.m_shm, m_buffer_width,
+                                       m_buffer_height);
+  }
+  for (;;) {
+    const PixelBuffer buffer = m_swapchain->acquire();
+    if (buffer.pixels) {
+      return buffer;
+    }
+    m_display.wait_events();
+  }
+}
+
+void Window::present_pixels(std::span<const Rect> damage) {
+  // Only the buffer already acquired is presented. Acquiring one here could
+  // dispatch events, and a resize would free the pixels that were just
+  // drawn. If there's none, whatever was drawn is lost, so the next frame
+  // damages everything.
+  if (!m_swapchain || !m_swapchain->has_acquired()) {
+    m_damage_all = true;
+    return;
+  }
+  // As in update(), the frame can't be attached yet or nobody would see it.
+  // The buffer stays acquired, and the next acquire_pixels() hands it out
+  // again.
+  if (!m_configured || !is_visible()) {
+    m_damage_all = true;
+    return;
+  }
+  auto *pending = prepare_commit();
+
+  wl_buffer *solid_buffer = std::exchange(m_solid_buffer, nullptr);
+  if (solid_buffer) {
+    reset_viewport();
+    set_opaque(true);
+  }
+  if (std::exchange(m_damage_all, false)) {
+    damage = {};
+  }
+  wl_surface_attach(m_surface, m_swapchain->present(), 0, 0);
+  // Damage is in buffer coordinates where the compositor understands them,
+  // so it stays exact if the buffer is scaled. Otherwise it's scaled to
+  // surface coordinates, rounding outwards.
+  if (damage.empty() || solid_buffer) {
+    wl_surface_damage(m_surface, 0, 0, m_width, m_height);
+  } else if (m_display.m_features.damage_buffer) {
+    for (const auto &rect : damage) {
+      wl_surface_damage_buffer(m_surface, rect.x, rect.y, rect.width,
+                               rect.height);
+    }
+  } else {
+    const auto to_surface = [](std::int32_t value, std::int32_t surface_size,
+                               std::int32_t buffer_size, bool round_up) {
+      std::int64_t scaled = std::int64_t{value} * surface_size;
+      if (round_up) {
+        scaled += buffer_size - 1;
+      }
+      return static_cast<std::int32_t>(scaled / buffer_size);
+    };
+    for (const auto &rect : damage) {
+      const std::int32_t x0 =
+          to_surface(rect.x, m_width, m_buffer_width, false);
+      const std::int32_t y0 =
+          to_surface(rect.y, m_height, m_buffer_height, false);
+      const std::int32_t x1 =
+          to_surface(rect.x + rect.width, m_width, m_buffer_width, true);
+      const std::int32_t y1 =
+          to_surface(rect.y + rect.height, m_height, m_buffer_height, true);
+      wl_surface_damage(m_surface, x0, y0, x1 - x0, y1 - y0);
+    }
+  }
+  wl_surface_commit(m_surface);
+  stamp_commit(pending);
+  if (solid_buffer) {
+    wl_buffer_destroy(solid_buffer);
+  }
 }
 
-void Window::update() {
-  wl_display_dispatch_pending(m_display);
-  eglSwapBuffers(m_egl_display, m_egl_surface);
+void Window::update(std::span<const Rect> damage) {
+  // Attaching a buffer before the first configure is acked is a protocol
+  // error. While suspended, swapping can block until the compositor shows
+  // the surface again, which may be never, and nobody would see the frame
+  // anyway.
+  if (!m_configured || !is_visible()) {
+    m_damage_all = true;
+    return;
+  }
+  auto *pending = prepare_commit();
+  if (std::exchange(m_damage_all, false)) {
+    damage = {};
+  }
+
+  // If we were showing a solid colour, the EGL buffer replaces it. The
+  // colour buffer must outlive the commit that replaces it.
+  wl_buffer *solid_buffer = std::exchange(m_solid_buffer, nullptr);
+  if (solid_buffer) {
+    reset_viewport();
+    set_opaque(true);
+    eglSwapBuffers(m_display.m_egl_display, m_egl_surface);
+    stamp_commit(pending);
+    wl_buffer_destroy(solid_buffer);
+    return;
+  }
+
+  if (damage.empty() || !m_display.m_swap_buffers_with_damage) {
+    eglSwapBuffers(m_display.m_egl_display, m_egl_surface);
+    stamp_commit(pending);
+    return;
+  }
+
+  // EGL wants rectangles with a bottom left origin. If there are more than
+  // fit on the stack, damaging their bounds is close enough.
+  std::array<EGLint, 4 * 32> rects;
+  std::size_t count = 0;
+  if (damage.size() <= rects.size() / 4) {
+    for (const auto &rect : damage) {
+      rects[count++] = rect.x;
+      rects[count++] = m_buffer_height - rect.y - rect.height;
+      rects[count++] = rect.width;
+      rects[count++] = rect.height;
+    }
+  } else {
+    std::int32_t x0 = m_buffer_width;
+    std::int32_t y0 = m_buffer_height;
+    std::int32_t x1 = 0;
+    std::int32_t y1 = 0;
+    for (const auto &rect : damage) {
+      x0 = std::min(x0, rect.x);
+      y0 = std::min(y0, rect.y);
+      x1 = std::max(x1, rect.x + rect.width);
+      y1 = std::max(y1, rect.y + rect.height);
+    }
+    rects[count++] = x0;
+    rects[count++] = m_buffer_height - y1;
+    rects[count++] = x1 - x0;
+    rects[count++] = y1 - y0;
+  }
+  m_display.m_swap_buffers_with_damage(m_display.m_egl_display, m_egl_surface,
+                                       rects.data(),
+                                       static_cast<EGLint>(count / 4));
+  stamp_commit(pending);
 }
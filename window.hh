@@ -2,72 +2,124 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 #pragma once
 
+#include "display.hh"
+#include "rect.hh"
+#include "swapchain.hh"
+
+#include <array>
 #include <cstdint>
+#include <memory>
+#include <span>
 
 struct wl_array;
-struct wl_compositor;
-struct wl_display;
+struct wl_buffer;
+struct wl_callback;
 struct wl_egl_window;
-struct wl_keyboard;
 struct wl_region;
-struct wl_registry;
-struct wl_seat;
+struct wl_output;
 struct wl_surface;
+struct wp_fractional_scale_v1;
+struct wp_presentation_feedback;
+struct wp_viewport;
 struct xdg_surface;
 struct xdg_toplevel;
-struct xdg_wm_base;
-struct xkb_context;
-struct xkb_keymap;
-struct xkb_state;
-struct zxdg_decoration_manager_v1;
+struct zwp_locked_pointer_v1;
 struct zxdg_toplevel_decoration_v1;
 
-using EGLContext = void *;
-using EGLDisplay = void *;
-using EGLSurface = void *;
+// Timing of a frame submitted by Window::update(), as reported by the
+// compositor. Times are in nanoseconds on Window::presentation_clock().
+struct FramePresentation {
+  std::uint64_t frame{0};
+  // Taken just after the swap or commit returned.
+  std::uint64_t commit_time{0};
+  std::uint64_t present_time{0};
+  // Zero if the refresh rate is unknown or variable.
+  std::uint32_t refresh{0};
+  // Vertical retrace counter, if the output has one.
+  std::uint64_t sequence{0};
+  bool vsync{false};
+  bool hw_clock{false};
+  bool hw_completion{false};
+  bool zero_copy{false};
+};
 
 class Window {
-  wl_display *m_display{nullptr};
+  friend class Display;
+
+  // An update() whose presentation feedback hasn't arrived yet.
+  struct PendingFeedback {
+    wp_presentation_feedback *feedback{nullptr};
+    std::uint64_t frame{0};
+    std::uint64_t commit_time{0};
+  };
 
-  // wayland globals
-  wl_registry *m_registry{nullptr};
-  wl_compositor *m_compositor{nullptr};
-  wl_seat *m_seat{nullptr};
-  xdg_wm_base *m_wm_base{nullptr};
-  zxdg_decoration_manager_v1 *m_decoration_manager{nullptr};
+  Display &m_display;
 
   // other wayland objects
+  wl_callback *m_frame_callback{nullptr};
   wl_region *m_region{nullptr};
-  wl_keyboard *m_keyboard{nullptr};
   wl_surface *m_surface{nullptr};
   xdg_surface *m_xdg_surface{nullptr};
   xdg_toplevel *m_xdg_toplevel{nullptr};
   zxdg_toplevel_decoration_v1 *m_toplevel_decoration{nullptr};
 
-  // xkbcommon
-  xkb_state *m_xkb_state{nullptr};
-  xkb_context *m_xkb_context{nullptr};
-  xkb_keymap *m_xkb_keymap{nullptr};
+  // single-pixel-buffer and viewporter
+  wl_buffer *m_solid_buffer{nullptr};
+  wp_viewport *m_viewport{nullptr};
+  // Whether m_region is set as the opaque region. Not while showing a
+  // translucent colour.
+  bool m_opaque{true};
+
+  // fractional-scale, with the viewport scaling the buffer down to the
+  // surface size.
+  wp_fractional_scale_v1 *m_fractional_scale{nullptr};
+  // In 120ths.
+  std::uint32_t m_scale{120};
+
+  // pointer-constraints
+  zwp_locked_pointer_v1 *m_locked_pointer{nullptr};
+  // Display::m_pointer_generation when the lock was made.
+  std::uint32_t m_locked_pointer_generation{0};
+  Cursor m_cursor{Cursor::arrow};
 
   // EGL
   wl_egl_window *m_egl_window{nullptr};
-  EGLDisplay m_egl_display{nullptr};
   EGLSurface m_egl_surface{nullptr};
   EGLContext m_egl_context{nullptr};
 
+  // Software rendering
+  std::unique_ptr<ShmSwapchain> m_swapchain;
+
+  // presentation-time
+  std::array<PendingFeedback, 8> m_pending_feedback{};
+  FramePresentation m_last_presentation{};
+  std::uint64_t m_frame_count{0};
+  std::uint64_t m_frames_discarded{0};
+
+  // Surface size, in logical pixels.
   std::int32_t m_width{0};
   std::int32_t m_height{0};
+  // Buffer size, in physical pixels.
+  std::int32_t m_buffer_width{0};
+  std::int32_t m_buffer_height{0};
+  // Size from xdg_toplevel.configure, applied on xdg_surface.configure.
+  std::int32_t m_pending_width{0};
+  std::int32_t m_pending_height{0};
+  // States from xdg_toplevel.configure, also applied on xdg_surface.configure.
+  std::uint32_t m_pending_states{0};
+  bool m_maximized{false};
+  bool m_fullscreen{false};
+  bool m_activated{false};
+  bool m_suspended{false};
+  bool m_configured{false};
   bool m_wants_close{false};
+  bool m_frame_callbacks{false};
+  // Set when a frame is dropped while suspended. Its damage was never sent,
+  // so the next frame damages everything.
+  bool m_damage_all{false};
 
-  // wl_registry callbacks
-  static void on_registry_global(void *, wl_registry *, std::uint32_t,
-                                 const char *, std::uint32_t) noexcept;
-  static void on_registry_global_remove(void *, wl_registry *,
-                                        std::uint32_t) noexcept;
-
-  // wl_seat callbacks
-  static void on_seat_capabilities(void *, wl_seat *, std::uint32_t) noexcept;
-  static void on_seat_name(void *, wl_seat *, const char *) noexcept;
+  // wl_callback callbacks
+  static void on_frame_done(void *, wl_callback *, std::uint32_t) noexcept;
 
   // wl_xdg_surface callbacks
   static void on_xdg_surface_configure(void *, xdg_surface *,
@@ -77,36 +129,141 @@ class Window {
   static void on_xdg_toplevel_configure(void *, xdg_toplevel *, std::int32_t,
                                         std::int32_t, wl_array *) noexcept;
   static void on_xdg_toplevel_close(void *, xdg_toplevel *) noexcept;
+  static void on_xdg_toplevel_configure_bounds(void *, xdg_toplevel *,
+                                               std::int32_t,
+                                               std::int32_t) noexcept;
+  static void on_xdg_toplevel_wm_capabilities(void *, xdg_toplevel *,
+                                              wl_array *) noexcept;
+
+  // wp_fractional_scale_v1 callbacks
+  static void on_preferred_scale(void *, wp_fractional_scale_v1 *,
+                                 std::uint32_t) noexcept;
+
+  // wp_presentation_feedback callbacks
+  static void on_feedback_sync_output(void *, wp_presentation_feedback *,
+                                      wl_output *) noexcept;
+  static void on_feedback_presented(void *, wp_presentation_feedback *,
+                                    std::uint32_t, std::uint32_t,
+                                    std::uint32_t, std::uint32_t,
+                                    std::uint32_t, std::uint32_t,
+                                    std::uint32_t) noexcept;
+  static void on_feedback_discarded(void *,
+                                    wp_presentation_feedback *) noexcept;
 
-  // wl_keyboard callbacks
-  static void on_keyboard_map(void *, wl_keyboard *, std::uint32_t,
-                              std::int32_t, std::uint32_t) noexcept;
-  static void on_keyboard_enter(void *, wl_keyboard *, std::uint32_t,
-                                wl_surface *, wl_array *) noexcept;
-  static void on_keyboard_leave(void *, wl_keyboard *, std::uint32_t,
-                                wl_surface *) noexcept;
-  static void on_keyboard_key(void *, wl_keyboard *, std::uint32_t,
-                              std::uint32_t, std::uint32_t,
-                              std::uint32_t) noexcept;
-  static void on_keyboard_mod(void *, wl_keyboard *, std::uint32_t,
-                              std::uint32_t, std::uint32_t, std::uint32_t,
-                              std::uint32_t) noexcept;
-  static void on_keyboard_repeat_info(void *, wl_keyboard *, std::int32_t,
-                                      std::int32_t) noexcept;
-
-  // xdg_wm_base_interface callbacks
-  static void on_wm_base_ping(void *, xdg_wm_base *, std::uint32_t) noexcept;
+  void init_egl();
+  void configure(std::uint32_t serial, std::int32_t width,
+                 std::int32_t height, std::uint32_t states);
+  void resize(std::int32_t width, std::int32_t height);
+  void resize_buffer();
+  void reset_viewport();
+  void set_opaque(bool opaque);
+  void commit_solid_color();
+  // Returns the feedback slot for the frame about to be committed, if any,
+  // for stamp_commit() once it has been.
+  PendingFeedback *prepare_commit();
+  void stamp_commit(PendingFeedback *pending);
+
+  PendingFeedback *find_pending_feedback(wp_presentation_feedback *);
+  PendingFeedback *request_presentation_feedback();
 
 public:
-  Window();
+  explicit Window(Display &display);
   Window(const Window *) = delete;
   Window(Window &&) = delete;
   ~Window();
 
+  // Creates the EGL context on first use.
   void make_current();
-  void update();
+  // Presents the current frame. If damage is non-empty and the driver
+  // supports it, only those rectangles are sent to the compositor as changed.
+  // Events aren't dispatched, here or between drawing and presenting: a
+  // configure would resize the window under a frame drawn at the old size.
+  void update(std::span<const Rect> damage = {});
+
+  // The number of frames ago that the contents of the back buffer were
+  // drawn, or 0 if they're undefined and everything must be redrawn. Only
+  // valid between make_current() and update().
+  std::int32_t buffer_age() const;
+
+  // When enabled, swaps don't block waiting for the compositor. Instead, each
+  // update() requests a frame callback, and ready_to_draw() returns false
+  // until the compositor signals that it wants another frame. It's also
+  // false until the first configure, before which nothing may be attached.
+  void set_frame_callbacks(bool enabled);
+  bool ready_to_draw() const {
+    return m_configured && m_frame_callback == nullptr && is_visible();
+  }
+
+  // Whether the compositor is showing the window. It isn't while suspended,
+  // such as when minimised or fully covered, and nothing drawn then would be
+  // seen, so ready_to_draw() is false and update() doesn't present.
+  bool is_visible() const { return !m_suspended; }
+  // Dispatches events until the window is visible or wants to close.
+  void wait_until_visible();
+
+  // Software rendering, as an alternative to EGL. Pixels are drawn straight
+  // into memory shared with the compositor, so nothing is copied. Acquiring
+  // blocks until the compositor releases a buffer. Damage is in buffer
+  // coordinates, as returned by TileRenderer::render().
+  //
+  // Nothing may dispatch events between acquire_pixels() and
+  // present_pixels(), including Display::wait_events(): a configure can
+  // resize the swapchain, which frees the acquired pixels. present_pixels()
+  // only presents an acquired buffer, and does nothing without one.
+  PixelBuffer acquire_pixels();
+  void present_pixels(std::span<const Rect> damage = {});
 
+  // Size in surface coordinates, which input uses.
   std::int32_t width() const { return m_width; };
   std::int32_t height() const { return m_height; };
+  // Size of the buffer drawn into, in physical pixels. Damage, buffer_age()
+  // and acquire_pixels() are in these. It differs from the surface size if
+  // the compositor supports wp_fractional_scale_manager_v1 and
+  // wp_viewporter, in which case the buffer has exactly the pixels shown.
+  std::int32_t buffer_width() const { return m_buffer_width; }
+  std::int32_t buffer_height() const { return m_buffer_height; }
+  // Physical pixels per logical pixel, such as 1.25 or 1.5.
+  float scale() const { return static_cast<float>(m_scale) / 120.f; }
   bool wants_close() const { return m_wants_close; }
+  bool is_maximized() const { return m_maximized; }
+  bool is_fullscreen() const { return m_fullscreen; }
+  // Whether the window has focus, as far as decorations are concerned.
+  bool is_activated() const { return m_activated; }
+
+  // Locks the pointer in place while it's over the window, for example to
+  // steer a 3D view with relative motion. The compositor decides when the
+  // lock takes effect, typically once the pointer is over the window.
+  // Returns false if pointer locking isn't supported or there's no pointer.
+  // A lock goes with the pointer if the seat loses it, after which locking
+  // again needs a new pointer.
+  bool set_pointer_locked(bool locked);
+
+  // The cursor shown while the pointer is over the window.
+  void set_cursor(Cursor cursor);
+
+  // Fills the window with a single colour without any rendering, using a
+  // single-pixel buffer scaled to the window size. The colour stays until the
+  // next update(). With alpha below 1, whatever is behind the window shows
+  // through. Requires wp_single_pixel_buffer_manager_v1 and
+  // wp_viewporter.
+  bool supports_solid_color() const {
+    return m_display.m_single_pixel_buffer_manager && m_display.m_viewporter;
+  }
+  void show_solid_color(float red, float green, float blue, float alpha = 1.f);
+
+  // Presentation timing. Only available if the compositor supports
+  // wp_presentation; otherwise no frame is ever reported as presented.
+  bool has_presentation_feedback() const {
+    return m_display.m_presentation != nullptr;
+  }
+  std::uint32_t presentation_clock() const {
+    return m_display.m_presentation_clock;
+  }
+  const FramePresentation &last_presentation() const {
+    return m_last_presentation;
+  }
+  std::uint64_t frames_discarded() const { return m_frames_discarded; }
+  // Predicts when the next frame will be presented, extrapolated from the
+  // last presented frame and the refresh interval.
+  std::uint64_t predict_next_present() const;
 };